@@ -1,22 +1,180 @@
 /**
  * Support for simple memory allocation.
+ *
+ * Every block carries a small header recording its size so that the
+ * statistics can account for reallocations and deallocations.  The
+ * counters are updated atomically so that threads may allocate too.
+ * Built with ALLOC_NO_STATS, the counters and the backend switch are
+ * left out, so that the allocator holds no mutable state at all.
  */
 
 #include "alloc.h"
 
+#include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "error.h"
 
+/**
+ * The header placed in front of each block, padded to keep the
+ * returned pointers suitably aligned for any type.
+ */
+typedef union {
+    size_t size;            ///< size requested by the caller
+    long double ld;         ///< for alignment only
+    void *p;                ///< for alignment only
+} header_t;
+
+static const alloc_backend_t default_backend = {
+    "malloc", malloc, realloc, free
+};
+
+#ifdef ALLOC_NO_STATS
+static const alloc_backend_t *const backend = &default_backend;
+
+#define count_call(counter)
+#define count_request(size) ((void) (size))
+#define add_in_use(size) ((void) (size))
+#define sub_in_use(size) ((void) (size))
+#else
+static const alloc_backend_t *backend = &default_backend;
+static alloc_stats_t stats;
+
+#define count_call(counter) __atomic_fetch_add(&stats.counter, 1, __ATOMIC_RELAXED)
+static void count_request(size_t size);
+static void add_in_use(size_t size);
+static void sub_in_use(size_t size);
+#endif
+
+void *try_alloc(size_t size) {
+    count_call(allocs);
+    count_request(size);
+    if (size > SIZE_MAX - sizeof(header_t)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    header_t *h = backend->acquire(sizeof(header_t) + size);
+    if (h == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    h->size = size;
+    add_in_use(size);
+    return h + 1;
+}
+
 void *alloc(size_t size) {
-    void *p = malloc(size);
-    if (p == NULL) die_with_message("shell: Memory exhausted\n");
+    void *p = try_alloc(size);
+    if (p == NULL) die_with_message("Memory exhausted");
     return p;
 }
 
+void *try_realloc_array(void *ptr, size_t nmemb, size_t size) {
+    count_call(reallocs);
+    if (size != 0 && nmemb > (SIZE_MAX - sizeof(header_t)) / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t total = nmemb*size;
+    count_request(total);
+    header_t *old = ptr == NULL ? NULL : (header_t *) ptr - 1;
+    size_t old_size = old == NULL ? 0 : old->size;
+    header_t *h = backend->resize(old, sizeof(header_t) + total);
+    if (h == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    h->size = total;
+    sub_in_use(old_size);
+    add_in_use(total);
+    return h + 1;
+}
+
 void *realloc_array(void *ptr, size_t nmemb, size_t size) {
-    void *p = realloc(ptr, nmemb*size);
-    if (p == NULL) die_with_message("shell: Memory exhausted\n");
+    void *p = try_realloc_array(ptr, nmemb, size);
+    if (p == NULL) die_with_message("Memory exhausted");
     return p;
 }
+
+void dealloc(void *ptr) {
+    if (ptr == NULL) return;
+    count_call(deallocs);
+    header_t *h = (header_t *) ptr - 1;
+    sub_in_use(h->size);
+    backend->release(h);
+}
+
+void alloc_get_stats(alloc_stats_t *s) {
+#ifdef ALLOC_NO_STATS
+    memset(s, 0, sizeof(alloc_stats_t));
+#else
+    s->allocs = __atomic_load_n(&stats.allocs, __ATOMIC_RELAXED);
+    s->reallocs = __atomic_load_n(&stats.reallocs, __ATOMIC_RELAXED);
+    s->deallocs = __atomic_load_n(&stats.deallocs, __ATOMIC_RELAXED);
+    s->in_use = __atomic_load_n(&stats.in_use, __ATOMIC_RELAXED);
+    s->peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+    for (int i = 0; i < ALLOC_SIZE_CLASSES; ++i)
+        s->size_classes[i] = __atomic_load_n(&stats.size_classes[i],
+                                             __ATOMIC_RELAXED);
+#endif
+}
+
+void alloc_print_stats(FILE *out) {
+    alloc_stats_t s;
+    alloc_get_stats(&s);
+    fprintf(out, "backend:  %s\n", backend->name);
+    fprintf(out, "calls:    %lu alloc, %lu realloc, %lu dealloc\n",
+            s.allocs, s.reallocs, s.deallocs);
+    fprintf(out, "in use:   %zu bytes\n", s.in_use);
+    fprintf(out, "peak:     %zu bytes\n", s.peak);
+    fprintf(out, "requests by size:\n");
+    for (int i = 0; i < ALLOC_SIZE_CLASSES; ++i) {
+        if (s.size_classes[i] == 0) continue;
+        if (i < ALLOC_SIZE_CLASSES - 1)
+            fprintf(out, "  <= %-8zu %lu\n", (size_t) 16 << i, s.size_classes[i]);
+        else
+            fprintf(out, "   > %-8zu %lu\n", (size_t) 16 << (i - 1), s.size_classes[i]);
+    }
+}
+
+void alloc_set_backend(const alloc_backend_t *b) {
+#ifdef ALLOC_NO_STATS
+    (void) b;
+#else
+    backend = b != NULL ? b : &default_backend;
+#endif
+}
+
+#ifndef ALLOC_NO_STATS
+/**
+ * Adds a request to the size class histogram.
+ */
+static void count_request(size_t size) {
+    int i = 0;
+    while (i < ALLOC_SIZE_CLASSES - 1 && size > (size_t) 16 << i) ++i;
+    __atomic_fetch_add(&stats.size_classes[i], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Accounts for newly allocated bytes, raising the peak if needed.
+ */
+static void add_in_use(size_t size) {
+    size_t now = __atomic_add_fetch(&stats.in_use, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+    while (now > peak
+           && !__atomic_compare_exchange_n(&stats.peak, &peak, now, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * Accounts for released bytes.
+ */
+static void sub_in_use(size_t size) {
+    __atomic_sub_fetch(&stats.in_use, size, __ATOMIC_RELAXED);
+}
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdio.h>
 
 /**
  * Allocates some memory.
@@ -18,7 +19,8 @@ void *alloc(size_t size);
  * Changes the size of the memory block pointed to by ptr to be large
  * enough for nmemb elements, each of which is size bytes.
  *
- * This function prints an error message and exits with status 1 on
+ * If ptr is NULL, this function allocates a new block.  This
+ * function prints an error message and exits with status 1 on
  * failures.
  *
  * @param ptr  pointer to the original memory block
@@ -27,3 +29,95 @@ void *alloc(size_t size);
  * @return a pointer to the reallocated array
  */
 void *realloc_array(void *ptr, size_t nmemb, size_t size);
+
+/**
+ * Like alloc(), but returns NULL with errno set to ENOMEM on failure
+ * instead of exiting, for code that must report errors to its caller.
+ *
+ * @param size  number of bytes to allocate
+ * @return a pointer to the allocated region, or NULL
+ */
+void *try_alloc(size_t size);
+
+/**
+ * Like realloc_array(), but returns NULL with errno set to ENOMEM on
+ * failure instead of exiting.  The original block is then left
+ * untouched.
+ *
+ * @param ptr  pointer to the original memory block
+ * @param nmemb  number of elements
+ * @param size  size of each elements
+ * @return a pointer to the reallocated array, or NULL
+ */
+void *try_realloc_array(void *ptr, size_t nmemb, size_t size);
+
+/**
+ * Frees a memory block returned by alloc(), realloc_array() or their
+ * try_ variants.
+ *
+ * Blocks from these functions must not be passed to free().
+ *
+ * @param ptr  pointer to the memory block or NULL
+ */
+void dealloc(void *ptr);
+
+/**
+ * The number of size classes in the allocation histogram.  Class 0
+ * counts requests of at most 16 bytes, class i of at most 16 << i
+ * bytes, and the last class all larger requests.
+ */
+#define ALLOC_SIZE_CLASSES 14
+
+/**
+ * A snapshot of the allocator statistics.
+ */
+typedef struct {
+    unsigned long allocs;       ///< number of calls to alloc()
+    unsigned long reallocs;     ///< number of calls to realloc_array()
+    unsigned long deallocs;     ///< number of calls to dealloc()
+    size_t in_use;              ///< bytes currently allocated
+    size_t peak;                ///< highest value reached by in_use
+    unsigned long size_classes[ALLOC_SIZE_CLASSES]; ///< requests per size
+} alloc_stats_t;
+
+/**
+ * Takes a snapshot of the allocator statistics.
+ *
+ * When built with ALLOC_NO_STATS, e.g. for libshparse, the allocator
+ * keeps no statistics, so that threads allocating concurrently share
+ * no state, and the snapshot is all zeros.
+ *
+ * @param stats  structure to fill
+ */
+void alloc_get_stats(alloc_stats_t *stats);
+
+/**
+ * Prints the allocator statistics in a human readable form.
+ *
+ * @param out  stream to print to
+ */
+void alloc_print_stats(FILE *out);
+
+/**
+ * The primitive functions used to obtain memory.
+ *
+ * The default backend forwards to malloc(), realloc() and free().
+ */
+typedef struct {
+    const char *name;                           ///< name shown in statistics
+    void *(*acquire)(size_t size);              ///< like malloc()
+    void *(*resize)(void *ptr, size_t size);    ///< like realloc()
+    void (*release)(void *ptr);                 ///< like free()
+} alloc_backend_t;
+
+/**
+ * Replaces the functions used to obtain memory, e.g., by a pool or
+ * an arena.  This has no effect when built with ALLOC_NO_STATS.
+ *
+ * Blocks are always returned to the backend that allocated them, so
+ * this function must be called before any allocation.  Passing NULL
+ * restores the default backend.
+ *
+ * @param backend  pointer to a backend that stays live, or NULL
+ */
+void alloc_set_backend(const alloc_backend_t *backend);
@@ -0,0 +1,67 @@
+#include <bandit/bandit.h>
+
+#include <cstdlib>
+
+extern "C" {
+#include "alloc.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+static int acquired;
+
+static void *counting_acquire(size_t size) {
+    ++acquired;
+    return malloc(size);
+}
+
+static const alloc_backend_t counting_backend = {
+    "counting", counting_acquire, realloc, free
+};
+
+go_bandit([]() {
+        describe("alloc", []() {
+                it("accounting for bytes in use", [&]() {
+                        alloc_stats_t before, during, after;
+                        alloc_get_stats(&before);
+                        void *p = alloc(100);
+                        p = realloc_array(p, 10, 30);
+                        alloc_get_stats(&during);
+                        AssertThat(during.in_use - before.in_use, Equals(300u));
+                        AssertThat(during.allocs - before.allocs, Equals(1u));
+                        AssertThat(during.reallocs - before.reallocs, Equals(1u));
+                        AssertThat(during.peak >= during.in_use, Equals(true));
+                        dealloc(p);
+                        alloc_get_stats(&after);
+                        AssertThat(after.in_use, Equals(before.in_use));
+                        AssertThat(after.deallocs - before.deallocs, Equals(1u));
+                    });
+                it("counting requests by size class", [&]() {
+                        alloc_stats_t before, after;
+                        alloc_get_stats(&before);
+                        dealloc(alloc(16));
+                        dealloc(alloc(17));
+                        dealloc(alloc(1 << 20));
+                        alloc_get_stats(&after);
+                        AssertThat(after.size_classes[0] - before.size_classes[0], Equals(1u));
+                        AssertThat(after.size_classes[1] - before.size_classes[1], Equals(1u));
+                        AssertThat(after.size_classes[ALLOC_SIZE_CLASSES - 1]
+                                   - before.size_classes[ALLOC_SIZE_CLASSES - 1], Equals(1u));
+                    });
+                it("growing a NULL array", [&]() {
+                        int *a = (int *) realloc_array(NULL, 4, sizeof(int));
+                        AssertThat(a, !IsNull());
+                        a[3] = 3;
+                        dealloc(a);
+                    });
+                it("using another backend", [&]() {
+                        acquired = 0;
+                        alloc_set_backend(&counting_backend);
+                        void *p = alloc(8);
+                        alloc_set_backend(NULL);
+                        AssertThat(acquired, Equals(1));
+                        dealloc(p);
+                    });
+            });
+    });
@@ -0,0 +1,179 @@
+/**
+ * Support for the bench builtin.
+ *
+ * Wall times are kept, then sorted for the percentiles; process usages
+ * are only summed per stage.
+ */
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "alloc.h"
+#include "number.h"
+
+/**
+ * The measures of one process of the pipeline.
+ */
+typedef struct {
+    char *name;             ///< name of the process
+    long samples;           ///< number of runs measured
+    double user_us;         ///< sum of user times
+    double sys_us;          ///< sum of system times
+    double maxrss_kb;       ///< sum of maximum resident set sizes
+} stage_t;
+
+/**
+ * This structure represents the measures of a bench.
+ */
+typedef struct bench {
+    long *walls;            ///< wall times of the runs, in microseconds
+    long nwalls;            ///< number of runs
+    long capacity;          ///< number of runs that can fit in walls
+    int sorted;             ///< non-zero if walls is sorted
+    stage_t *stages;        ///< measures of the processes
+    int nstages;            ///< number of processes
+} bench_t;
+
+static int compare_longs(const void *a, const void *b);
+static void print_json_string(FILE *out, const char *s);
+static double mean(double sum, long samples);
+
+
+int bench_parse_options(char **argv, bench_options_t *o) {
+    o->runs = 10;
+    o->warmup = 0;
+    o->json = 0;
+
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-j") == 0) {
+            o->json = 1;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            if (!parse_count(argv[++i], &o->runs) || o->runs == 0) return 0;
+        } else if (strcmp(argv[i], "-w") == 0) {
+            if (!parse_count(argv[++i], &o->warmup)) return 0;
+        } else {
+            return 0;
+        }
+    }
+    return argv[i] != NULL ? i : 0;
+}
+
+bench_t *bench_new(void) {
+    bench_t *b = alloc(sizeof(bench_t));
+    memset(b, 0, sizeof(bench_t));
+    return b;
+}
+
+void bench_add_run(bench_t *b, long wall_us) {
+    if (b->nwalls == b->capacity) {
+        b->capacity = b->capacity == 0 ? 16 : 2 * b->capacity;
+        b->walls = realloc_array(b->walls, b->capacity, sizeof(long));
+    }
+    b->walls[b->nwalls++] = wall_us;
+    b->sorted = 0;
+}
+
+void bench_add_stage(bench_t *b, int stage, const char *name,
+                     const struct rusage *usage) {
+    if (stage >= b->nstages) {
+        b->stages = realloc_array(b->stages, stage + 1, sizeof(stage_t));
+        memset(b->stages + b->nstages, 0, (stage + 1 - b->nstages) * sizeof(stage_t));
+        b->nstages = stage + 1;
+    }
+    stage_t *s = &b->stages[stage];
+    if (s->name == NULL) {
+        s->name = alloc(strlen(name) + 1);
+        strcpy(s->name, name);
+    }
+    ++s->samples;
+    s->user_us += usage->ru_utime.tv_sec * 1e6 + usage->ru_utime.tv_usec;
+    s->sys_us += usage->ru_stime.tv_sec * 1e6 + usage->ru_stime.tv_usec;
+    s->maxrss_kb += usage->ru_maxrss;
+}
+
+long bench_percentile(bench_t *b, double p) {
+    if (!b->sorted) {
+        qsort(b->walls, b->nwalls, sizeof(long), compare_longs);
+        b->sorted = 1;
+    }
+    long rank = (long) (p / 100 * b->nwalls + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > b->nwalls) rank = b->nwalls;
+    return b->walls[rank - 1];
+}
+
+void bench_report(bench_t *b, FILE *out, const bench_options_t *o) {
+    if (b->nwalls == 0) return;
+    long min = bench_percentile(b, 0);
+    long median = bench_percentile(b, 50);
+    long p95 = bench_percentile(b, 95);
+    long p99 = bench_percentile(b, 99);
+
+    if (o->json) {
+        fprintf(out, "{\"runs\": %ld, \"warmup\": %ld, \"wall_us\": "
+                "{\"min\": %ld, \"median\": %ld, \"p95\": %ld, \"p99\": %ld}, "
+                "\"stages\": [", b->nwalls, o->warmup, min, median, p95, p99);
+        for (int i = 0; i < b->nstages; ++i) {
+            stage_t *s = &b->stages[i];
+            fprintf(out, "%s{\"name\": ", i > 0 ? ", " : "");
+            print_json_string(out, s->name != NULL ? s->name : "");
+            fprintf(out, ", \"user_us\": %.0f, \"sys_us\": %.0f, \"maxrss_kb\": %.0f}",
+                    mean(s->user_us, s->samples), mean(s->sys_us, s->samples),
+                    mean(s->maxrss_kb, s->samples));
+        }
+        fprintf(out, "]}\n");
+        return;
+    }
+
+    fprintf(out, "runs:     %ld (warmup %ld)\n", b->nwalls, o->warmup);
+    fprintf(out, "wall:     min %.3f ms, median %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+            min / 1e3, median / 1e3, p95 / 1e3, p99 / 1e3);
+    for (int i = 0; i < b->nstages; ++i) {
+        stage_t *s = &b->stages[i];
+        fprintf(out, "stage %d:  %-12s user %.3f ms, sys %.3f ms, rss %.0f KiB\n",
+                i, s->name != NULL ? s->name : "", mean(s->user_us, s->samples) / 1e3,
+                mean(s->sys_us, s->samples) / 1e3, mean(s->maxrss_kb, s->samples));
+    }
+}
+
+void bench_free(bench_t *b) {
+    if (b == NULL) return;
+    for (int i = 0; i < b->nstages; ++i) dealloc(b->stages[i].name);
+    dealloc(b->stages);
+    dealloc(b->walls);
+    dealloc(b);
+}
+
+
+/**
+ * Compares two longs for qsort().
+ */
+static int compare_longs(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Prints a string as a JSON string literal.
+ */
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20)         fprintf(out, "\\u%04x", c);
+        else                       fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/**
+ * Returns the mean of samples values summing to sum.
+ */
+static double mean(double sum, long samples) {
+    return samples > 0 ? sum / samples : 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * Support for the bench builtin of the shell, which times repeated
+ * runs of a pipeline:
+ *
+ *    bench [ -n RUNS ] [ -w WARMUP ] [ -j ] PIPELINE
+ *
+ * The pipeline runs WARMUP times untimed, then RUNS times timed.  The
+ * report gives the minimum, median, 95th and 99th percentiles of the
+ * wall time of the runs, and for each process of the pipeline the
+ * mean user and system time and the mean maximum resident set size,
+ * as reported by wait4().  With -j, the report is a JSON object.
+ *
+ * Built-in filters run as threads of the shell, so they have no
+ * usage of their own.
+ */
+
+struct rusage; // forward declaration
+struct bench; // forward declaration
+
+/**
+ * The options of the bench builtin.
+ */
+typedef struct {
+    long runs;              ///< number of timed runs
+    long warmup;            ///< number of untimed runs first
+    int json;               ///< non-zero for a JSON report
+} bench_options_t;
+
+/**
+ * Parses the options of the bench builtin.
+ *
+ * @param argv  arguments of the first command, starting with "bench"
+ * @param o  filled with the options, or their defaults
+ * @return the number of words up to the pipeline, or 0 if the options
+ *     are malformed or no pipeline follows
+ */
+int bench_parse_options(char **argv, bench_options_t *o);
+
+/**
+ * Allocates an empty set of measures.
+ *
+ * On unrecoverable errors this function calls die_with_message().
+ *
+ * @return measures to free with bench_free()
+ */
+struct bench *bench_new(void);
+
+/**
+ * Records the wall time of a timed run.
+ */
+void bench_add_run(struct bench *b, long wall_us);
+
+/**
+ * Records the usage of one process of a timed run.
+ *
+ * @param b  measures
+ * @param stage  index of the process in launch order
+ * @param name  name of the process; the first one recorded is kept
+ * @param usage  as filled by wait4()
+ */
+void bench_add_stage(struct bench *b, int stage, const char *name,
+                     const struct rusage *usage);
+
+/**
+ * Computes a percentile of the wall times with the nearest-rank
+ * method.
+ *
+ * @param b  measures of at least one run
+ * @param p  percentile, in (0, 100]
+ * @return a wall time in microseconds
+ */
+long bench_percentile(struct bench *b, double p);
+
+/**
+ * Prints the report.
+ *
+ * @param b  measures
+ * @param out  where to print
+ * @param o  options the measures were made with
+ */
+void bench_report(struct bench *b, FILE *out, const bench_options_t *o);
+
+/**
+ * Frees measures.
+ *
+ * @param b  measures returned by bench_new(), or NULL
+ */
+void bench_free(struct bench *b);
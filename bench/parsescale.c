@@ -0,0 +1,125 @@
+/**
+ * Measures how the throughput of parse() from libshparse scales with
+ * threads:
+ *
+ *    make bench/parsescale && bench/parsescale [-n LINES] [-e EFFICIENCY]
+ *
+ * With 1, 2, 4, ... threads up to the number of CPUs allowed, each
+ * thread parses LINES command lines.  For each count, prints the
+ * throughput and the efficiency, i.e. the speedup over one thread
+ * divided by the number of threads.  Exits with status 1 if the
+ * efficiency with every CPU busy is below EFFICIENCY, 0.8 by default,
+ * as happens when parsers contend on shared state.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parse.h"
+
+/**
+ * Lines in the style of recorded command lines.
+ */
+static const char *lines[] = {
+    "grep -v DEBUG < app.log | sort | uniq -c | sort -rn | head -20",
+    "cat access.log |{ wc -l ; grep 404 | wc -l ; grep 500 > errors.txt }",
+    "tar -czf backup.tar.gz $( find . -name *.conf ) > /dev/null",
+    "ls -la",
+    "awk -F , { print $3 } < data.csv | sort -n | tail -1 > max.txt",
+};
+
+#define NLINES (sizeof(lines) / sizeof(lines[0]))
+
+static long nparses = 200000;
+static pthread_barrier_t barrier;
+static int failed;
+
+/**
+ * The body of each thread.
+ */
+static void *run(void *arg) {
+    (void) arg;
+    char buffer[256];
+    pthread_barrier_wait(&barrier);
+    for (long i = 0; i < nparses; ++i) {
+        // parse() cuts its input, so it gets a fresh copy each time.
+        strcpy(buffer, lines[i % NLINES]);
+        struct root *r = parse(buffer);
+        if (r == NULL || !r->valid) __atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+        if (r != NULL) parse_end(r);
+    }
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+/**
+ * Runs the threads, returning the number of lines parsed per second.
+ */
+static double measure(int nthreads) {
+    pthread_t threads[nthreads];
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; ++i) {
+        if (pthread_create(&threads[i], NULL, run, NULL) != 0) {
+            perror("pthread_create");
+            exit(2);
+        }
+    }
+    struct timespec start, end;
+    pthread_barrier_wait(&barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_barrier_wait(&barrier);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int i = 0; i < nthreads; ++i) pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return nthreads * nparses / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    double threshold = 0.8;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:")) != -1) {
+        switch (opt) {
+        case 'n':
+            nparses = atol(optarg);
+            break;
+        case 'e':
+            threshold = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n LINES] [-e EFFICIENCY]\n", argv[0]);
+            return 2;
+        }
+    }
+    cpu_set_t set;
+    sched_getaffinity(0, sizeof(set), &set);
+    int ncpus = CPU_COUNT(&set);
+
+    double base = 0, efficiency = 1;
+    printf("threads  lines/s      efficiency\n");
+    for (int n = 1; ; n = 2 * n < ncpus ? 2 * n : ncpus) {
+        double rate = measure(n);
+        if (n == 1) base = rate;
+        efficiency = rate / (n * base);
+        printf("%-8d %-12.0f %.2f\n", n, rate, efficiency);
+        if (n == ncpus) break;
+    }
+    if (failed) {
+        fprintf(stderr, "parse failed\n");
+        return 1;
+    }
+    if (efficiency < threshold) {
+        fprintf(stderr, "efficiency %.2f with %d threads is below %.2f\n",
+                efficiency, ncpus, threshold);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Measures the throughput of a multi-stage pipeline run by the shell
+# without placement, then under each placement of the pin prefix.
+#
+#    bench/pin.sh [MEGABYTES [RUNS [STAGES]]]
+#
+# Prints the best and median throughput of RUNS runs per placement.
+# Run it from a built tree; the effect shows on hosts with several
+# cache domains or packages.
+
+set -e
+cd "$(dirname "$0")/.."
+
+size=${1:-256}
+runs=${2:-5}
+stages=${3:-4}
+
+data=$(mktemp)
+trap 'rm -f "$data"' EXIT
+head -c $((size * 1024 * 1024)) /dev/urandom | base64 > "$data"
+bytes=$(wc -c < "$data")
+
+pipeline="cat $data"
+i=0
+while [ $i -lt "$stages" ]; do
+    pipeline="$pipeline | tr a-m n-z"
+    i=$((i + 1))
+done
+pipeline="$pipeline > /dev/null"
+
+ncpus=$(nproc)
+printf '%s stages, %s MB, %s CPUs\n' "$stages" $((bytes / 1048576)) "$ncpus"
+printf '%-12s %12s %12s\n' placement 'best MB/s' 'median MB/s'
+
+for mode in none compact spread "cpus=0"; do
+    if [ "$mode" = none ]; then line=$pipeline; else line="pin $mode $pipeline"; fi
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(date +%s%N)
+        echo "$line" | ./shell > /dev/null
+        end=$(date +%s%N)
+        echo $(((end - start) / 1000))
+        i=$((i + 1))
+    done | sort -n | awk -v bytes="$bytes" -v mode="$mode" '
+        { us[NR] = $1 }
+        END {
+            printf "%-12s %12.1f %12.1f\n", mode,
+                bytes / us[1], bytes / us[int((NR + 1) / 2)]
+        }'
+done
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Measures the launch latency of a trivial command at the end of a
+# long session, with the processes forked by the shell itself, then
+# launched through the zygote (SHELL_ZYGOTE, see zygote.h).
+#
+#    bench/zygote.sh [HISTORY_MB [RUNS]]
+#
+# The long session is played as HISTORY_MB megabytes of history, made
+# of lines the parser rejects so that they launch nothing.  The shell
+# reads its input a byte at a time, so allow about a second per
+# megabyte.  Prints the bench report of "true" once at startup and
+# once after the history, for each launch path.
+
+set -e
+cd "$(dirname "$0")/.."
+
+mb=${1:-32}
+runs=${2:-500}
+
+history=$(mktemp)
+trap 'rm -f "$history"' EXIT
+awk -v n=$((mb * 1024)) 'BEGIN {
+    s = "| "
+    for (i = 0; i < 1000; ++i) s = s "x"
+    for (i = 0; i < n; ++i) print s
+}' > "$history"
+
+for path in fork zygote; do
+    if [ "$path" = zygote ]; then SHELL_ZYGOTE=1; export SHELL_ZYGOTE; fi
+    printf '%s, short session:\n' "$path"
+    echo "bench -n $runs -w 10 true" | ./shell 2> /dev/null | grep '^wall'
+    printf '%s, after %s MB of history:\n' "$path" "$mb"
+    { cat "$history"; echo "bench -n $runs -w 10 true"; } | ./shell 2> /dev/null | grep '^wall'
+done
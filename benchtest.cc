@@ -0,0 +1,103 @@
+#include <bandit/bandit.h>
+
+#include <string>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "bench.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Returns the report of a bench as a string.
+ */
+static std::string report(struct bench *b, const bench_options_t *o) {
+    char *data;
+    size_t length;
+    FILE *out = open_memstream(&data, &length);
+    bench_report(b, out, o);
+    fclose(out);
+    std::string s(data, length);
+    free(data);
+    return s;
+}
+
+go_bandit([]() {
+        describe("bench_parse_options", []() {
+                it("parsing the defaults", [&]() {
+                        const char *argv[] = { "bench", "ls", NULL };
+                        bench_options_t o;
+                        AssertThat(bench_parse_options((char **) argv, &o), Equals(1));
+                        AssertThat(o.runs, Equals(10));
+                        AssertThat(o.warmup, Equals(0));
+                        AssertThat(o.json, Equals(0));
+                    });
+                it("parsing all the options", [&]() {
+                        const char *argv[] = { "bench", "-n", "100", "-j", "-w", "3", "ls", "-l", NULL };
+                        bench_options_t o;
+                        AssertThat(bench_parse_options((char **) argv, &o), Equals(6));
+                        AssertThat(o.runs, Equals(100));
+                        AssertThat(o.warmup, Equals(3));
+                        AssertThat(o.json, Equals(1));
+                    });
+                it("rejecting malformed options", [&]() {
+                        const char *missing[] = { "bench", "-n", NULL };
+                        const char *zero[] = { "bench", "-n", "0", "ls", NULL };
+                        const char *unknown[] = { "bench", "-x", "ls", NULL };
+                        const char *alone[] = { "bench", "-j", NULL };
+                        bench_options_t o;
+                        AssertThat(bench_parse_options((char **) missing, &o), Equals(0));
+                        AssertThat(bench_parse_options((char **) zero, &o), Equals(0));
+                        AssertThat(bench_parse_options((char **) unknown, &o), Equals(0));
+                        AssertThat(bench_parse_options((char **) alone, &o), Equals(0));
+                    });
+            });
+
+        describe("bench_percentile", []() {
+                it("using the nearest rank", [&]() {
+                        struct bench *b = bench_new();
+                        for (long wall = 100; wall >= 1; --wall) bench_add_run(b, wall);
+                        AssertThat(bench_percentile(b, 0), Equals(1));
+                        AssertThat(bench_percentile(b, 50), Equals(50));
+                        AssertThat(bench_percentile(b, 95), Equals(95));
+                        AssertThat(bench_percentile(b, 99), Equals(99));
+                        AssertThat(bench_percentile(b, 100), Equals(100));
+                        bench_add_run(b, 1000);
+                        AssertThat(bench_percentile(b, 100), Equals(1000));
+                        bench_free(b);
+                    });
+                it("handling a single run", [&]() {
+                        struct bench *b = bench_new();
+                        bench_add_run(b, 42);
+                        AssertThat(bench_percentile(b, 1), Equals(42));
+                        AssertThat(bench_percentile(b, 99), Equals(42));
+                        bench_free(b);
+                    });
+            });
+
+        describe("bench_report", []() {
+                it("reporting in JSON", [&]() {
+                        struct bench *b = bench_new();
+                        struct rusage u = {};
+                        for (int i = 1; i <= 2; ++i) {
+                            u.ru_utime.tv_usec = 1000 * i;
+                            u.ru_maxrss = 100 * i;
+                            bench_add_stage(b, 0, "say \"hi\"", &u);
+                            bench_add_stage(b, 1, "wc", &u);
+                            bench_add_run(b, 10 * i);
+                        }
+                        bench_options_t o = { 2, 1, 1 };
+                        AssertThat(report(b, &o), Equals(
+                            "{\"runs\": 2, \"warmup\": 1, \"wall_us\": "
+                            "{\"min\": 10, \"median\": 10, \"p95\": 20, \"p99\": 20}, "
+                            "\"stages\": [{\"name\": \"say \\\"hi\\\"\", \"user_us\": 1500, "
+                            "\"sys_us\": 0, \"maxrss_kb\": 150}, {\"name\": \"wc\", "
+                            "\"user_us\": 1500, \"sys_us\": 0, \"maxrss_kb\": 150}]}\n"));
+                        bench_free(b);
+                    });
+            });
+    });
@@ -0,0 +1,501 @@
+/**
+ * Support for the cache builtin of the shell.
+ *
+ * An entry is written to a temporary file of the store and renamed
+ * into place only once its run succeeded, so that concurrent shells
+ * sharing a store never replay a partial output.  Temporary files left
+ * behind by a crash are removed by a later eviction.
+ */
+
+#define _GNU_SOURCE
+
+#include "cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "error.h"
+#include "parse.h"
+#include "thread.h"
+
+/**
+ * The size of the copy buffers.
+ */
+#define BUFFER 65536
+
+/**
+ * The age in seconds after which a temporary file is deemed left
+ * behind.
+ */
+#define STALE_AGE 86400
+
+/**
+ * The state of a SHA-256 computation.
+ */
+typedef struct {
+    uint32_t state[8];          ///< intermediate hash value
+    uint64_t length;            ///< number of bytes hashed
+    unsigned char block[64];    ///< pending bytes
+    size_t used;                ///< number of pending bytes
+} sha256_t;
+
+/**
+ * This structure represents a store.
+ */
+typedef struct cache {
+    char *dir;                  ///< directory of the entries
+    uint64_t capacity;          ///< most bytes to keep
+} cache_t;
+
+/**
+ * This structure represents an entry being filled.
+ */
+typedef struct cache_fill {
+    cache_t *c;                 ///< store
+    char key[CACHE_KEY_SIZE];   ///< key of the entry
+    char *temp;                 ///< path of the entry while written
+    int in;                     ///< where to read from
+    int out;                    ///< where the output goes, or -1 once gone
+    int store;                  ///< the temporary file, or -1 on failure
+    pthread_t thread;           ///< thread running run()
+    int started;                ///< non-zero if thread was created
+} cache_fill_t;
+
+/**
+ * An entry of the store, while evicting.
+ */
+typedef struct {
+    char *name;                 ///< file name
+    struct timespec used;       ///< time of last use
+    off_t size;                 ///< number of bytes
+} entry_t;
+
+static int add_file(sha256_t *h, const char *path, int contents);
+static void add_string(sha256_t *h, const char *s);
+static void *run(void *arg);
+static int write_all(int fd, const char *data, size_t length);
+static void evict(cache_t *c);
+static int is_key(const char *name);
+static int compare_used(const void *a, const void *b);
+static void sha256_init(sha256_t *h);
+static void sha256_update(sha256_t *h, const void *data, size_t length);
+static void sha256_final(sha256_t *h, char key[CACHE_KEY_SIZE]);
+static void sha256_block(sha256_t *h, const unsigned char *block);
+
+
+int cache_parse_options(char **argv, cache_options_t *o) {
+    o->contents = 0;
+    o->nenv = 0;
+
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-c") == 0) {
+            o->contents = 1;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            if (argv[++i] == NULL || o->nenv == CACHE_MAX_ENV) return 0;
+            o->env[o->nenv++] = argv[i];
+        } else {
+            return 0;
+        }
+    }
+    return argv[i] != NULL ? i : 0;
+}
+
+int cache_parse_size(const char *s, uint64_t *size) {
+    if (*s < '0' || *s > '9') return 0;
+    uint64_t n = 0;
+    for (; *s >= '0' && *s <= '9'; ++s) {
+        if (n > (UINT64_MAX - 9) / 10) return 0;
+        n = 10 * n + (*s - '0');
+    }
+    int shift = 0;
+    if (*s == 'K')      shift = 10;
+    else if (*s == 'M') shift = 20;
+    else if (*s == 'G') shift = 30;
+    if (shift != 0) ++s;
+    if (*s != '\0' || n > UINT64_MAX >> shift) return 0;
+    *size = n << shift;
+    return 1;
+}
+
+int cache_key(command_t *cmd, int skip, const cache_options_t *o,
+              char key[CACHE_KEY_SIZE]) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return -1;
+
+    sha256_t h;
+    sha256_init(&h);
+    add_string(&h, "cache 1");
+    add_string(&h, cwd);
+    for (command_t *c = cmd; c != NULL; c = c->next) {
+        if (c->branches != NULL || c->substitutions != NULL) return -1;
+        add_string(&h, "|");
+        for (int i = c == cmd ? skip : 0; c->argv[i] != NULL; ++i) {
+            add_string(&h, c->argv[i]);
+            if (add_file(&h, c->argv[i], o->contents) < 0) return -1;
+        }
+        if (c->infile != NULL) {
+            add_string(&h, "<");
+            add_string(&h, c->infile);
+            if (add_file(&h, c->infile, o->contents) < 0) return -1;
+        }
+    }
+    for (int i = 0; i < o->nenv; ++i) {
+        const char *value = getenv(o->env[i]);
+        add_string(&h, o->env[i]);
+        add_string(&h, value != NULL ? "=" : "unset");
+        if (value != NULL) add_string(&h, value);
+    }
+    sha256_final(&h, key);
+    return 0;
+}
+
+cache_t *cache_open(const char *dir, uint64_t capacity) {
+    // Create each missing directory of the path.
+    char path[PATH_MAX];
+    if ((size_t) snprintf(path, sizeof(path), "%s", dir) >= sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    for (char *p = path + 1; ; ++p) {
+        if (*p != '/' && *p != '\0') continue;
+        char saved = *p;
+        *p = '\0';
+        if (mkdir(path, 0700) < 0 && errno != EEXIST) return NULL;
+        *p = saved;
+        if (saved == '\0') break;
+    }
+
+    cache_t *c = alloc(sizeof(cache_t));
+    c->dir = alloc(strlen(dir) + 1);
+    strcpy(c->dir, dir);
+    c->capacity = capacity;
+    return c;
+}
+
+void cache_close(cache_t *c) {
+    dealloc(c->dir);
+    dealloc(c);
+}
+
+int cache_replay(cache_t *c, const char *key, int out) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", c->dir, key);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    // The modification time orders the entries for eviction.
+    futimens(fd, NULL);
+
+    char *buffer = alloc(BUFFER);
+    ssize_t n;
+    while ((n = read(fd, buffer, BUFFER)) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            err_with_errno(path);
+            break;
+        }
+        if (write_all(out, buffer, n) < 0) {
+            if (errno != EPIPE) err_with_errno("write");
+            break;
+        }
+    }
+    dealloc(buffer);
+    close(fd);
+    return 0;
+}
+
+cache_fill_t *cache_fill_start(cache_t *c, const char *key, int in, int out) {
+    cache_fill_t *f = alloc(sizeof(cache_fill_t));
+    f->c = c;
+    strcpy(f->key, key);
+    f->temp = alloc(strlen(c->dir) + strlen("/tmp.XXXXXX") + 1);
+    sprintf(f->temp, "%s/tmp.XXXXXX", c->dir);
+    f->in = in;
+    f->out = out;
+    f->store = mkostemp(f->temp, O_CLOEXEC);
+    if (f->store < 0) err_with_errno(c->dir);
+
+    int rc = start_thread(&f->thread, run, f);
+
+    f->started = rc == 0;
+    if (!f->started) {
+        err_with_errnum("cache", rc);
+        close(in);
+    }
+    return f;
+}
+
+int cache_fill_end(cache_fill_t *f, int keep) {
+    if (f->started) pthread_join(f->thread, NULL);
+    int added = -1;
+    if (f->store >= 0) {
+        keep = keep && f->started;
+        if (close(f->store) < 0) {
+            err_with_errno(f->temp);
+            keep = 0;
+        }
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", f->c->dir, f->key);
+        if (keep && rename(f->temp, path) == 0) {
+            added = 0;
+            evict(f->c);
+        } else {
+            unlink(f->temp);
+        }
+    }
+    dealloc(f->temp);
+    dealloc(f);
+    return added;
+}
+
+
+/**
+ * Hashes the identity of a file or directory, or its contents with
+ * contents non-zero if it is a file.  Other paths add a marker.
+ *
+ * @return 0, or -1 if the contents cannot be read
+ */
+static int add_file(sha256_t *h, const char *path, int contents) {
+    struct stat st;
+    if (stat(path, &st) < 0 || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+        add_string(h, "-");
+        return 0;
+    }
+    if (!contents || S_ISDIR(st.st_mode)) {
+        char identity[128];
+        snprintf(identity, sizeof(identity), "%llu %llu %lld %lld.%09ld",
+                 (unsigned long long) st.st_dev, (unsigned long long) st.st_ino,
+                 (long long) st.st_size, (long long) st.st_mtim.tv_sec,
+                 st.st_mtim.tv_nsec);
+        add_string(h, identity);
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char *buffer = alloc(BUFFER);
+    ssize_t n;
+    while ((n = read(fd, buffer, BUFFER)) != 0) {
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        sha256_update(h, buffer, n);
+    }
+    dealloc(buffer);
+    close(fd);
+    add_string(h, "");
+    return n < 0 ? -1 : 0;
+}
+
+/**
+ * Hashes a string with its terminator, keeping consecutive strings
+ * apart.
+ */
+static void add_string(sha256_t *h, const char *s) {
+    sha256_update(h, s, strlen(s) + 1);
+}
+
+/**
+ * The body of a fill thread.
+ */
+static void *run(void *arg) {
+    cache_fill_t *f = arg;
+    char *buffer = alloc(BUFFER);
+    ssize_t n = 0;
+    while (f->out >= 0 || f->store >= 0) {
+        n = read(f->in, buffer, BUFFER);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) err_with_errno("read");
+        if (n <= 0) break;
+        if (f->out >= 0 && write_all(f->out, buffer, n) < 0) {
+            if (errno != EPIPE) err_with_errno("write");
+            f->out = -1;
+        }
+        if (f->store >= 0 && write_all(f->store, buffer, n) < 0) {
+            err_with_errno(f->temp);
+            close(f->store);
+            unlink(f->temp);
+            f->store = -1;
+        }
+    }
+    // An incomplete output must not be stored.
+    if (n < 0 && f->store >= 0) {
+        close(f->store);
+        unlink(f->temp);
+        f->store = -1;
+    }
+    close(f->in);
+    dealloc(buffer);
+    return NULL;
+}
+
+/**
+ * Writes all the bytes.
+ *
+ * @return 0, or -1 with errno set
+ */
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * Removes the least recently used entries until the store fits its
+ * capacity, and the temporary files left behind.
+ */
+static void evict(cache_t *c) {
+    DIR *d = opendir(c->dir);
+    if (d == NULL) return;
+
+    entry_t *entries = NULL;
+    size_t n = 0, capacity = 0;
+    uint64_t total = 0;
+    time_t now = time(NULL);
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        struct stat st;
+        if (fstatat(dirfd(d), e->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)) continue;
+        if (strncmp(e->d_name, "tmp.", 4) == 0) {
+            if (now - st.st_mtim.tv_sec > STALE_AGE) unlinkat(dirfd(d), e->d_name, 0);
+            continue;
+        }
+        if (!is_key(e->d_name)) continue;
+        if (n == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            entries = realloc_array(entries, capacity, sizeof(entry_t));
+        }
+        entries[n].name = alloc(strlen(e->d_name) + 1);
+        strcpy(entries[n].name, e->d_name);
+        entries[n].used = st.st_mtim;
+        entries[n].size = st.st_size;
+        total += st.st_size;
+        ++n;
+    }
+
+    if (total > c->capacity) {
+        qsort(entries, n, sizeof(entry_t), compare_used);
+        for (size_t i = 0; i < n && total > c->capacity; ++i) {
+            if (unlinkat(dirfd(d), entries[i].name, 0) == 0) total -= entries[i].size;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) dealloc(entries[i].name);
+    dealloc(entries);
+    closedir(d);
+}
+
+/**
+ * Tells whether a file name is a key.
+ */
+static int is_key(const char *name) {
+    size_t i = 0;
+    for (; name[i] != '\0'; ++i)
+        if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+            return 0;
+    return i == CACHE_KEY_SIZE - 1;
+}
+
+/**
+ * Orders entries from the least recently used.
+ */
+static int compare_used(const void *a, const void *b) {
+    const struct timespec *x = &((const entry_t *) a)->used;
+    const struct timespec *y = &((const entry_t *) b)->used;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    if (x->tv_nsec != y->tv_nsec) return x->tv_nsec < y->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+
+// SHA-256, as specified in FIPS 180-4.
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_init(sha256_t *h) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(h->state, initial, sizeof(initial));
+    h->length = 0;
+    h->used = 0;
+}
+
+static void sha256_update(sha256_t *h, const void *data, size_t length) {
+    const unsigned char *p = data;
+    h->length += length;
+    while (length > 0) {
+        size_t n = 64 - h->used < length ? 64 - h->used : length;
+        memcpy(h->block + h->used, p, n);
+        h->used += n;
+        p += n;
+        length -= n;
+        if (h->used == 64) {
+            sha256_block(h, h->block);
+            h->used = 0;
+        }
+    }
+}
+
+static void sha256_final(sha256_t *h, char key[CACHE_KEY_SIZE]) {
+    uint64_t bits = h->length * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t npad = (h->used < 56 ? 56 : 120) - h->used;
+    for (int i = 0; i < 8; ++i) pad[npad + i] = bits >> (56 - 8 * i);
+    sha256_update(h, pad, npad + 8);
+    for (int i = 0; i < 8; ++i) sprintf(key + 8 * i, "%08x", (unsigned) h->state[i]);
+}
+
+static void sha256_block(sha256_t *h, const unsigned char *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16
+               | (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h->state[0], b = h->state[1], c = h->state[2], d = h->state[3];
+    uint32_t e = h->state[4], f = h->state[5], g = h->state[6], k = h->state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = k + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h->state[0] += a; h->state[1] += b; h->state[2] += c; h->state[3] += d;
+    h->state[4] += e; h->state[5] += f; h->state[6] += g; h->state[7] += k;
+}
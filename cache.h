@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Support for the cache builtin of the shell, which replays the output
+ * of a pipeline whose inputs did not change:
+ *
+ *    cache [ -c ] [ -e NAME ]... PIPELINE
+ *
+ * The key of a run is a SHA-256 digest of the current directory, the
+ * words of the pipeline, the files they name and the input
+ * redirections, and the environment variables given with -e.  Files
+ * are identified by their size and modification time, or by their
+ * contents with -c.  Pipelines with fan-outs or command substitutions
+ * are not cached.
+ *
+ * The store is a directory holding the output of each successful run
+ * in a file named after its key.  Each replay refreshes the
+ * modification time of the file, and the least recently used files
+ * are removed whenever the store grows beyond its capacity.  Only the
+ * standard output is stored.
+ */
+
+struct command; // forward declaration
+struct cache; // forward declaration
+struct cache_fill; // forward declaration
+
+/**
+ * The number of characters of a key, including the terminator.
+ */
+#define CACHE_KEY_SIZE 65
+
+/**
+ * The most environment variables given with -e.
+ */
+#define CACHE_MAX_ENV 16
+
+/**
+ * The capacity of a store, in bytes, unless configured otherwise.
+ */
+#define CACHE_CAPACITY (256 << 20)
+
+/**
+ * The options of the cache builtin.
+ */
+typedef struct {
+    int contents;                       ///< non-zero to hash file contents
+    int nenv;                           ///< number of variables
+    const char *env[CACHE_MAX_ENV];     ///< names of the variables
+} cache_options_t;
+
+/**
+ * Parses the options of the cache builtin.
+ *
+ * @param argv  arguments from the word "cache"
+ * @param o  filled with the options, or their defaults
+ * @return the number of words up to the pipeline, or 0 if the options
+ *     are malformed or no pipeline follows
+ */
+int cache_parse_options(char **argv, cache_options_t *o);
+
+/**
+ * Parses a size in bytes, with an optional K, M or G suffix.
+ *
+ * @return non-zero if s is a valid size, stored in size
+ */
+int cache_parse_size(const char *s, uint64_t *size);
+
+/**
+ * Computes the key of a pipeline.
+ *
+ * @param cmd  first command of the pipeline
+ * @param skip  number of prefix words of the first command to ignore
+ * @param o  options of the cache builtin
+ * @param key  filled with the key, in hexadecimal
+ * @return 0, or -1 if the pipeline cannot be cached
+ */
+int cache_key(struct command *cmd, int skip, const cache_options_t *o,
+              char key[CACHE_KEY_SIZE]);
+
+/**
+ * Opens a store, creating its directory as needed.
+ *
+ * On unrecoverable errors this function calls die_with_message().
+ *
+ * @param dir  directory of the store
+ * @param capacity  most bytes to keep
+ * @return the store, to close with cache_close(), or NULL with errno
+ *     set if the directory cannot be created
+ */
+struct cache *cache_open(const char *dir, uint64_t capacity);
+
+/**
+ * Closes a store.
+ */
+void cache_close(struct cache *c);
+
+/**
+ * Writes the output stored under a key, if any, marking it as recently
+ * used.
+ *
+ * @param c  store
+ * @param key  key of the run
+ * @param out  where to write the output
+ * @return 0 if the output was replayed, -1 if the key is not stored
+ */
+int cache_replay(struct cache *c, const char *key, int out);
+
+/**
+ * Starts copying everything read from in to out and to a new entry of
+ * the store, in a background thread.  A consumer going away on out
+ * does not stop the copy to the store.
+ *
+ * The thread takes ownership of in, not of out.  On failure to create
+ * the entry, an error is printed and the data only goes to out; on
+ * failure to start the thread, an error is printed and in is closed.
+ *
+ * On unrecoverable errors this function calls die_with_message().
+ *
+ * @param c  store
+ * @param key  key of the run
+ * @param in  read end of the producer's pipe
+ * @param out  where the output goes
+ * @return a handle for cache_fill_end()
+ */
+struct cache_fill *cache_fill_start(struct cache *c, const char *key, int in, int out);
+
+/**
+ * Waits for the copy to complete, then adds the entry to the store or
+ * drops it, and frees the handle.  Adding an entry removes the least
+ * recently used ones beyond the capacity of the store.
+ *
+ * @param f  handle returned by cache_fill_start()
+ * @param keep  non-zero to add the entry, zero to drop it
+ * @return 0 if the entry was added, else -1
+ */
+int cache_fill_end(struct cache_fill *f, int keep);
@@ -0,0 +1,191 @@
+#include <bandit/bandit.h>
+
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "parse.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Computes the key of a line run with the given options, or "" if it
+ * cannot be cached.
+ */
+static std::string key_of(const char *line, const char *options = "cache") {
+    std::string input = std::string(options) + " " + line;
+    root_t *r = parse(&input[0]);
+    AssertThat(r->valid, !Equals(0));
+    cache_options_t o;
+    int skip = cache_parse_options(r->first_command->argv, &o);
+    AssertThat(skip, !Equals(0));
+    char key[CACHE_KEY_SIZE];
+    int rc = cache_key(r->first_command, skip, &o, key);
+    parse_end(r);
+    return rc == 0 ? key : "";
+}
+
+/**
+ * Writes a file.
+ */
+static void write_file(const std::string &path, const char *content) {
+    FILE *f = fopen(path.c_str(), "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+/**
+ * Stores an output under a key.
+ */
+static void store(struct cache *c, const char *key, const std::string &data, int keep = 1) {
+    int p[2];
+    AssertThat(pipe(p), Equals(0));
+    int null = open("/dev/null", O_WRONLY);
+    struct cache_fill *f = cache_fill_start(c, key, p[0], null);
+    AssertThat(write(p[1], data.data(), data.size()), Equals((ssize_t) data.size()));
+    close(p[1]);
+    cache_fill_end(f, keep);
+    close(null);
+}
+
+/**
+ * Replays the output stored under a key, or returns "-" if absent.
+ */
+static std::string replay(struct cache *c, const char *key) {
+    char path[] = "/tmp/cachetestoutXXXXXX";
+    int fd = mkstemp(path);
+    unlink(path);
+    if (cache_replay(c, key, fd) < 0) {
+        close(fd);
+        return "-";
+    }
+    char buffer[256];
+    ssize_t n = pread(fd, buffer, sizeof(buffer), 0);
+    close(fd);
+    return std::string(buffer, n > 0 ? n : 0);
+}
+
+/**
+ * Sets the time of last use of an entry.
+ */
+static void set_used(const std::string &dir, const char *key, time_t t) {
+    struct timespec times[2] = { { t, 0 }, { t, 0 } };
+    utimensat(AT_FDCWD, (dir + "/" + key).c_str(), times, 0);
+}
+
+static std::string key_name(char c) {
+    return std::string(CACHE_KEY_SIZE - 1, c);
+}
+
+go_bandit([]() {
+        describe("cache_parse_options", []() {
+                it("parsing options and the pipeline", [&]() {
+                        cache_options_t o;
+                        char *argv[] = { (char *) "cache", (char *) "-c", (char *) "-e", (char *) "LANG",
+                                         (char *) "sort", NULL };
+                        AssertThat(cache_parse_options(argv, &o), Equals(4));
+                        AssertThat(o.contents, Equals(1));
+                        AssertThat(o.nenv, Equals(1));
+                        AssertThat(o.env[0], Equals("LANG"));
+                    });
+                it("rejecting malformed options", [&]() {
+                        cache_options_t o;
+                        char *none[] = { (char *) "cache", (char *) "-c", NULL };
+                        AssertThat(cache_parse_options(none, &o), Equals(0));
+                        char *bad[] = { (char *) "cache", (char *) "-x", (char *) "ls", NULL };
+                        AssertThat(cache_parse_options(bad, &o), Equals(0));
+                        char *missing[] = { (char *) "cache", (char *) "-e", NULL };
+                        AssertThat(cache_parse_options(missing, &o), Equals(0));
+                    });
+            });
+
+        describe("cache_parse_size", []() {
+                it("parsing sizes with suffixes", [&]() {
+                        uint64_t size;
+                        AssertThat(cache_parse_size("1000", &size), Equals(1));
+                        AssertThat(size, Equals(1000u));
+                        AssertThat(cache_parse_size("3K", &size), Equals(1));
+                        AssertThat(size, Equals(3072u));
+                        AssertThat(cache_parse_size("2G", &size), Equals(1));
+                        AssertThat(size, Equals(2ull << 30));
+                        AssertThat(cache_parse_size("", &size), Equals(0));
+                        AssertThat(cache_parse_size("5X", &size), Equals(0));
+                        AssertThat(cache_parse_size("99999999999999999999", &size), Equals(0));
+                    });
+            });
+
+        describe("cache_key", []() {
+                it("depending on the words and the options", [&]() {
+                        std::string k = key_of("sort -r");
+                        AssertThat(k.size(), Equals((size_t) CACHE_KEY_SIZE - 1));
+                        AssertThat(key_of("sort -r"), Equals(k));
+                        AssertThat(key_of("sort"), !Equals(k));
+                        AssertThat(key_of("sort -r", "cache -e SOME_VARIABLE"), !Equals(k));
+                    });
+                it("depending on the named files", [&]() {
+                        char dir[] = "/tmp/cachetestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        std::string file = std::string(dir) + "/in";
+                        std::string line = "sort < " + file;
+                        write_file(file, "b\na\n");
+                        std::string before = key_of(line.c_str(), "cache -c");
+                        write_file(file, "c\na\n");
+                        AssertThat(key_of(line.c_str(), "cache -c"), !Equals(before));
+                        line = "wc " + file;
+                        struct timespec times[2] = { { 1, 0 }, { 1, 0 } };
+                        utimensat(AT_FDCWD, file.c_str(), times, 0);
+                        before = key_of(line.c_str());
+                        times[1].tv_sec = 2;
+                        utimensat(AT_FDCWD, file.c_str(), times, 0);
+                        AssertThat(key_of(line.c_str()), !Equals(before));
+                        unlink(file.c_str());
+                        rmdir(dir);
+                    });
+                it("refusing fan-outs and substitutions", [&]() {
+                        AssertThat(key_of("echo $( ls )"), Equals(""));
+                        AssertThat(key_of("ls |{ wc ; cat }"), Equals(""));
+                    });
+            });
+
+        describe("store", []() {
+                it("replaying stored outputs only", [&]() {
+                        char dir[] = "/tmp/cachetestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        std::string path = std::string(dir) + "/store";
+                        struct cache *c = cache_open(path.c_str(), 1 << 20);
+                        AssertThat(c, !IsNull());
+                        std::string a = key_name('a'), b = key_name('b');
+                        AssertThat(replay(c, a.c_str()), Equals("-"));
+                        store(c, a.c_str(), "hello\n");
+                        store(c, b.c_str(), "failed\n", 0);
+                        AssertThat(replay(c, a.c_str()), Equals("hello\n"));
+                        AssertThat(replay(c, b.c_str()), Equals("-"));
+                        cache_close(c);
+                        if (system(("rm -rf " + std::string(dir)).c_str()) != 0) {}
+                    });
+                it("evicting the least recently used entries", [&]() {
+                        char dir[] = "/tmp/cachetestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        struct cache *c = cache_open(dir, 20);
+                        std::string a = key_name('a'), b = key_name('b'), d = key_name('d');
+                        store(c, a.c_str(), "0123456789");
+                        set_used(dir, a.c_str(), 100);
+                        store(c, b.c_str(), "0123456789");
+                        set_used(dir, b.c_str(), 200);
+                        AssertThat(replay(c, a.c_str()), Equals("0123456789"));
+                        store(c, d.c_str(), "0123456789");
+                        AssertThat(replay(c, b.c_str()), Equals("-"));
+                        AssertThat(replay(c, a.c_str()), Equals("0123456789"));
+                        AssertThat(replay(c, d.c_str()), Equals("0123456789"));
+                        cache_close(c);
+                        if (system(("rm -rf " + std::string(dir)).c_str()) != 0) {}
+                    });
+            });
+    });
@@ -0,0 +1,141 @@
+/**
+ * Support for command substitution.
+ *
+ * The reader keeps at least a page of free space at the end of its
+ * buffer and asks read() for all of it, so a large output takes a
+ * logarithmic number of reallocations and few system calls.
+ */
+
+#define _GNU_SOURCE
+
+#include "capture.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "error.h"
+#include "thread.h"
+
+/**
+ * The initial size of the buffer.
+ */
+#define INITIAL_SIZE 65536
+
+/**
+ * The least free space to offer to each read().
+ */
+#define MIN_READ 4096
+
+/**
+ * This structure represents a running capture.
+ */
+typedef struct capture {
+    pthread_t thread;       ///< thread running run()
+    int started;            ///< non-zero if thread was created
+    int fd;                 ///< where to read from
+    size_t max;             ///< maximum number of bytes
+    char *data;             ///< size bytes plus one for a terminator
+    size_t size;            ///< usable size of data
+    size_t length;          ///< number of bytes read
+    int error;              ///< errno of a failed read, else 0
+    int overflow;           ///< non-zero if more than max bytes came
+} capture_t;
+
+static void *run(void *arg);
+static int is_separator(char c);
+
+
+capture_t *capture_start(int fd, size_t max) {
+    capture_t *c = alloc(sizeof(capture_t));
+    c->fd = fd;
+    c->max = max;
+    c->size = max < INITIAL_SIZE ? max : INITIAL_SIZE;
+    c->data = alloc(c->size + 1);
+    c->length = 0;
+    c->error = 0;
+    c->overflow = 0;
+
+    int rc = start_thread(&c->thread, run, c);
+
+    c->started = rc == 0;
+    if (!c->started) {
+        c->error = rc;
+        close(fd);
+    }
+    return c;
+}
+
+char *capture_wait(capture_t *c, size_t *length) {
+    if (c->started) pthread_join(c->thread, NULL);
+    char *data = c->data;
+    *length = c->length;
+    if (c->overflow) {
+        char message[64];
+        snprintf(message, sizeof(message),
+                 "command substitution exceeds %zu bytes", c->max);
+        err_with_message(message);
+    } else if (c->error != 0) {
+        err_with_errnum("command substitution", c->error);
+    }
+    if (c->overflow || c->error != 0) {
+        dealloc(data);
+        data = NULL;
+    } else {
+        data[c->length] = '\0';
+    }
+    dealloc(c);
+    return data;
+}
+
+int split_words(char *data, size_t length, char **words) {
+    int n = 0;
+    size_t i = 0;
+    for (;;) {
+        while (i < length && is_separator(data[i])) ++i;
+        if (i == length) return n;
+        if (words != NULL) words[n] = data + i;
+        ++n;
+        while (i < length && !is_separator(data[i])) ++i;
+        if (words != NULL) data[i] = '\0';
+    }
+}
+
+
+/**
+ * The body of a capture thread.
+ */
+static void *run(void *arg) {
+    capture_t *c = arg;
+    for (;;) {
+        if (c->size - c->length < MIN_READ && c->size < c->max) {
+            c->size = c->size > c->max / 2 ? c->max : 2 * c->size;
+            c->data = realloc_array(c->data, c->size + 1, 1);
+        }
+        // One byte more than allowed tells an overflow from a full buffer.
+        size_t room = c->size - c->length;
+        char extra;
+        ssize_t n;
+        if (room > 0) n = read(c->fd, c->data + c->length, room);
+        else          n = read(c->fd, &extra, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) c->error = errno;
+        if (n <= 0) break;
+        if (room == 0) {
+            c->overflow = 1;
+            break;
+        }
+        c->length += n;
+    }
+    close(c->fd);
+    return NULL;
+}
+
+/**
+ * Tells whether a character separates words.
+ */
+static int is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\0';
+}
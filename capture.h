@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Support for command substitution: reading the output of a pipeline
+ * into memory and splitting it into words.
+ *
+ * The output is read in a background thread while the pipeline runs,
+ * straight into a buffer that doubles as it fills, so each byte is
+ * copied once out of the pipe.  The words are then delimited in place
+ * in that buffer.
+ */
+
+struct capture; // forward declaration
+
+/**
+ * The most output a command substitution may capture.
+ */
+#define CAPTURE_MAX (16 * 1024 * 1024)
+
+/**
+ * Starts reading everything from fd up to end-of-file, in a
+ * background thread.
+ *
+ * The thread takes ownership of fd.  Should the data exceed max
+ * bytes, the thread closes fd at once, which ends the writers with
+ * SIGPIPE or EPIPE.  On failure to start the thread, fd is closed
+ * and an error is printed.
+ *
+ * @param fd  read end of a pipe
+ * @param max  maximum number of bytes to capture
+ * @return a handle for capture_wait()
+ */
+struct capture *capture_start(int fd, size_t max);
+
+/**
+ * Waits for a capture to reach end-of-file and frees it.
+ *
+ * On failure, including an output exceeding the maximum, an error is
+ * printed.
+ *
+ * @param c  handle returned by capture_start()
+ * @param length  set to the number of bytes captured
+ * @return the captured bytes, null-terminated, to free with dealloc(),
+ *     or NULL on failure
+ */
+char *capture_wait(struct capture *c, size_t *length);
+
+/**
+ * Splits captured output into words, in place.
+ *
+ * Words are separated by runs of spaces, tabs, newlines or null
+ * characters.  When words is non-NULL, the separators are overwritten
+ * with null characters and words receives pointers into data.
+ *
+ * @param data  captured bytes, followed by a null character
+ * @param length  number of bytes in data
+ * @param words  where to store the words, or NULL to only count them
+ * @return the number of words
+ */
+int split_words(char *data, size_t length, char **words);
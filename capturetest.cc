@@ -0,0 +1,101 @@
+#include <bandit/bandit.h>
+
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "capture.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Captures what a thread writes to a pipe, in chunks of a given size.
+ */
+static char *capture_writes(const std::string &data, size_t chunk, size_t max, size_t *length) {
+    int fds[2];
+    AssertThat(pipe(fds), Equals(0));
+    struct capture *c = capture_start(fds[0], max);
+    std::thread writer([&]() {
+            for (size_t i = 0; i < data.size(); i += chunk) {
+                size_t n = std::min(chunk, data.size() - i);
+                if (write(fds[1], data.data() + i, n) < 0) break;
+            }
+            close(fds[1]);
+        });
+    writer.join();
+    return capture_wait(c, length);
+}
+
+go_bandit([]() {
+        describe("capture", []() {
+                it("capturing a short output", [&]() {
+                        size_t length;
+                        char *data = capture_writes("a b\n", 4, CAPTURE_MAX, &length);
+                        AssertThat(data, !IsNull());
+                        AssertThat(length, Equals(4u));
+                        AssertThat(std::string(data), Equals("a b\n"));
+                        dealloc(data);
+                    });
+                it("capturing an output larger than the initial buffer", [&]() {
+                        std::string big;
+                        for (int i = 0; i < 100000; ++i) big += "word" + std::to_string(i) + "\n";
+                        size_t length;
+                        char *data = capture_writes(big, 7000, CAPTURE_MAX, &length);
+                        AssertThat(data, !IsNull());
+                        AssertThat(length, Equals(big.size()));
+                        AssertThat(std::string(data, length), Equals(big));
+                        dealloc(data);
+                    });
+                it("capturing exactly the maximum", [&]() {
+                        size_t length;
+                        char *data = capture_writes(std::string(5000, 'x'), 1000, 5000, &length);
+                        AssertThat(data, !IsNull());
+                        AssertThat(length, Equals(5000u));
+                        dealloc(data);
+                    });
+                it("rejecting an output over the maximum", [&]() {
+                        // The writer sees the pipe close instead of blocking.
+                        int saved = dup(STDERR_FILENO);
+                        int null = open("/dev/null", O_WRONLY);
+                        dup2(null, STDERR_FILENO);
+                        signal(SIGPIPE, SIG_IGN);
+                        size_t length;
+                        char *data = capture_writes(std::string(1 << 20, 'x'), 4096, 5000, &length);
+                        signal(SIGPIPE, SIG_DFL);
+                        dup2(saved, STDERR_FILENO);
+                        close(saved);
+                        close(null);
+                        AssertThat(data, IsNull());
+                    });
+            });
+
+        describe("split_words", []() {
+                it("splitting on runs of blanks", [&]() {
+                        char data[] = "  one\ttwo\n\nthree ";
+                        AssertThat(split_words(data, sizeof(data) - 1, NULL), Equals(3));
+                        char *words[3];
+                        AssertThat(split_words(data, sizeof(data) - 1, words), Equals(3));
+                        AssertThat(words[0], Equals("one"));
+                        AssertThat(words[1], Equals("two"));
+                        AssertThat(words[2], Equals("three"));
+                        AssertThat(words[0] - data, Equals(2));
+                    });
+                it("splitting an output without words", [&]() {
+                        char data[] = " \n\t";
+                        AssertThat(split_words(data, sizeof(data) - 1, NULL), Equals(0));
+                        AssertThat(split_words(data, 0, NULL), Equals(0));
+                    });
+                it("splitting on null characters", [&]() {
+                        char data[] = "a\0b";
+                        char *words[2];
+                        AssertThat(split_words(data, 3, words), Equals(2));
+                        AssertThat(words[1], Equals("b"));
+                    });
+            });
+    });
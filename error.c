@@ -1,18 +1,29 @@
 /**
  * Handle errors.
+ *
+ * Messages are assembled in an iovec array on the stack and emitted
+ * with a single writev() on the standard error, so that the err_*
+ * functions neither allocate nor use stdio.  They are thus safe to
+ * call in signal handlers and in children between fork() and exec(),
+ * and messages from concurrent processes never interleave.
  */
 
+#define _GNU_SOURCE
+
 #include "error.h"
 
+#include <errno.h>
 #include <stddef.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-#include "alloc.h"
+static void emit(const char *s, const char *message);
+static const char *describe(int errnum);
 
 void err_with_message(const char *message) {
-    fprintf(stderr, "shell: %s\n", message);
+    emit(NULL, message);
 }
 
 void die_with_message(const char *message) {
@@ -21,16 +32,56 @@ void die_with_message(const char *message) {
 }
 
 void err_with_errno(const char *s) {
-    if (s == NULL || strlen(s) == 0)
-        perror("shell: ");
-    else {
-        char *prefix = alloc(strlen("shell: ") + strlen(s) + 1);
-        prefix[0] = 0;
-        perror(strcat(strcat(prefix, "shell: "), s));
-    }
+    err_with_errnum(s, errno);
+}
+
+void err_with_errnum(const char *s, int errnum) {
+    emit(s != NULL && *s ? s : NULL, describe(errnum));
 }
 
 void die_with_errno(const char *s) {
     err_with_errno(s);
     exit(1);
 }
+
+/**
+ * Writes "shell: [s: ]message\n" on the standard error in one system
+ * call, leaving errno untouched.
+ */
+static void emit(const char *s, const char *message) {
+    int saved_errno = errno;
+    struct iovec iov[5];
+    int n = 0;
+
+    iov[n].iov_base = "shell: ";
+    iov[n++].iov_len = strlen("shell: ");
+    if (s != NULL) {
+        iov[n].iov_base = (char *) s;
+        iov[n++].iov_len = strlen(s);
+        iov[n].iov_base = ": ";
+        iov[n++].iov_len = strlen(": ");
+    }
+    iov[n].iov_base = (char *) message;
+    iov[n++].iov_len = strlen(message);
+    iov[n].iov_base = "\n";
+    iov[n++].iov_len = 1;
+
+    while (writev(STDERR_FILENO, iov, n) < 0 && errno == EINTR)
+        ;
+    errno = saved_errno;
+}
+
+/**
+ * Returns the static description of an error number.
+ *
+ * strerror() may format unknown numbers into a shared buffer; glibc's
+ * strerrordesc_np() only returns constant strings.
+ */
+static const char *describe(int errnum) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 32))
+    const char *d = strerrordesc_np(errnum);
+    return d != NULL ? d : "Unknown error";
+#else
+    return strerror(errnum);
+#endif
+}
@@ -1,5 +1,13 @@
 #pragma once
 
+/**
+ * The err_* functions below neither allocate memory nor use stdio:
+ * each message is written to the standard error with a single system
+ * call.  They are async-signal-safe and may be called in a child
+ * between fork() and exec().  The die_* functions call exit() and are
+ * not.
+ */
+
 /**
  * Prints an error message.
  *
@@ -19,7 +27,7 @@ void err_with_message(const char *message);
 void die_with_message(const char *message);
 
 /**
- * Calls perror() with a prefix.
+ * Prints the error message corresponding to errno, like perror().
  *
  * The string "shell: " is prepended to the error message.  If s is
  * not empty, s, followed by ": ", is placed between "shell: " and the
@@ -34,7 +42,19 @@ void die_with_message(const char *message);
 void err_with_errno(const char *s);
 
 /**
- * Calls perror() with a prefix and exits with status 1.
+ * Prints the error message corresponding to an error number.
+ *
+ * This function behaves like err_with_errno() but takes the error
+ * number as a parameter, e.g., one reported by a child process.
+ *
+ * @param s  a string or NULL
+ * @param errnum  an error number
+ */
+void err_with_errnum(const char *s, int errnum);
+
+/**
+ * Prints the error message corresponding to errno and exits with
+ * status 1.
  *
  * The string "shell: " is prepended to the error message.  If s is
  * not NULL, s, followed by ": ", is placed between "shell: " and the
@@ -0,0 +1,203 @@
+/**
+ * Support for pipeline fan-out.
+ *
+ * Each round duplicates the next chunk of the input pipe to all the
+ * consumers but the last one with tee(), which does not consume the
+ * input, then moves the chunk to the last consumer with splice().
+ * The first successful tee() sets the size of the chunk; should a
+ * later tee() copy less, because a consumer's pipe is nearly full,
+ * the chunk is read into a buffer instead and the missing bytes are
+ * written from there.
+ */
+
+#define _GNU_SOURCE
+
+#include "fanout.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "error.h"
+#include "thread.h"
+
+/**
+ * The size of the largest chunk moved per round; it must not exceed
+ * the size of the buffer.
+ */
+#define CHUNK 65536
+
+/**
+ * This structure represents a running fan-out.
+ */
+typedef struct fanout {
+    pthread_t thread;       ///< thread running pump()
+    int in;                 ///< read end of the producer's pipe
+    int *outs;              ///< write ends of the consumers, -1 once dropped
+    int n;                  ///< number of consumers
+    char *buffer;           ///< room for one chunk, for partial tees
+} fanout_t;
+
+static void *pump(void *arg);
+static int pump_chunk(fanout_t *f);
+static int write_fully(fanout_t *f, int i, const char *data, size_t length);
+static int discard(fanout_t *f, size_t length);
+static void drop(fanout_t *f, int i);
+
+fanout_t *fanout_start(int in, const int *outs, int n) {
+    fanout_t *f = alloc(sizeof(fanout_t));
+    f->in = in;
+    f->n = n;
+    f->outs = alloc(n * sizeof(int));
+    memcpy(f->outs, outs, n * sizeof(int));
+    f->buffer = NULL;
+
+    int rc = start_thread(&f->thread, pump, f);
+
+    if (rc != 0) {
+        err_with_errnum("fan-out", rc);
+        close(in);
+        for (int i = 0; i < n; ++i) drop(f, i);
+        dealloc(f->outs);
+        dealloc(f);
+        return NULL;
+    }
+    return f;
+}
+
+void fanout_wait(fanout_t *f) {
+    if (f == NULL) return;
+    pthread_join(f->thread, NULL);
+    dealloc(f->buffer);
+    dealloc(f->outs);
+    dealloc(f);
+}
+
+/**
+ * Moves chunks until end-of-file, an error, or no consumer is left.
+ */
+static void *pump(void *arg) {
+    fanout_t *f = arg;
+    while (pump_chunk(f) > 0)
+        ;
+    close(f->in);
+    for (int i = 0; i < f->n; ++i) drop(f, i);
+    return NULL;
+}
+
+/**
+ * Moves one chunk from the input to every live consumer.
+ *
+ * @return the size of the chunk, 0 at the end, or -1 on errors
+ */
+static int pump_chunk(fanout_t *f) {
+    int last = f->n - 1;
+    while (last >= 0 && f->outs[last] < 0) --last;
+    if (last < 0) return 0;
+
+    // Duplicate the chunk to all the consumers but the last one.
+    ssize_t length = 0;
+    ssize_t copied[f->n];
+    int partial = 0;
+    for (int i = 0; i < last; ++i) {
+        if (f->outs[i] < 0) continue;
+        ssize_t m;
+        while ((m = tee(f->in, f->outs[i], length ? length : CHUNK, 0)) < 0
+               && errno == EINTR)
+            ;
+        if (m < 0) {
+            if (errno != EPIPE) err_with_errno("tee");
+            drop(f, i);
+            continue;
+        }
+        if (m == 0) return 0;   // end-of-file
+        if (length == 0) length = m;
+        copied[i] = m;
+        if (m < length) partial = 1;
+    }
+
+    // Consume the chunk by moving it to the last consumer.
+    if (!partial) {
+        ssize_t moved = 0;
+        while (length == 0 || moved < length) {
+            ssize_t m = splice(f->in, NULL, f->outs[last], NULL,
+                               length ? length - moved : CHUNK, SPLICE_F_MOVE);
+            if (m < 0 && errno == EINTR) continue;
+            if (m < 0 && errno == EPIPE) {
+                drop(f, last);
+                return length ? discard(f, length - moved) : 1;
+            }
+            if (m < 0) {
+                err_with_errno("splice");
+                return -1;
+            }
+            if (m == 0) return 0;   // end-of-file
+            if (length == 0) length = m;
+            moved += m;
+        }
+        return length;
+    }
+
+    // Some consumer got only part of the chunk: go through the buffer.
+    if (f->buffer == NULL) f->buffer = alloc(CHUNK);
+    for (ssize_t got = 0; got < length; ) {
+        ssize_t m = read(f->in, f->buffer + got, length - got);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) {
+            err_with_errno("fan-out");
+            return -1;
+        }
+        got += m;
+    }
+    for (int i = 0; i < last; ++i)
+        if (f->outs[i] >= 0 && copied[i] < length)
+            write_fully(f, i, f->buffer + copied[i], length - copied[i]);
+    write_fully(f, last, f->buffer, length);
+    return length;
+}
+
+/**
+ * Writes data to consumer i, dropping it if it went away.
+ */
+static int write_fully(fanout_t *f, int i, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t m = write(f->outs[i], data, length);
+        if (m < 0 && errno == EINTR) continue;
+        if (m < 0) {
+            if (errno != EPIPE) err_with_errno("fan-out");
+            drop(f, i);
+            return 0;
+        }
+        data += m;
+        length -= m;
+    }
+    return 1;
+}
+
+/**
+ * Consumes bytes of the input that no consumer wants anymore.
+ *
+ * @return 1, or -1 on errors
+ */
+static int discard(fanout_t *f, size_t length) {
+    if (f->buffer == NULL) f->buffer = alloc(CHUNK);
+    while (length > 0) {
+        ssize_t m = read(f->in, f->buffer, length < CHUNK ? length : CHUNK);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) return -1;
+        length -= m;
+    }
+    return 1;
+}
+
+/**
+ * Closes the pipe of consumer i, if not already done.
+ */
+static void drop(fanout_t *f, int i) {
+    if (f->outs[i] < 0) return;
+    close(f->outs[i]);
+    f->outs[i] = -1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * Support for pipeline fan-out: copying the data of one pipe to
+ * several pipes.
+ *
+ * The data is duplicated with tee() and consumed with splice(), so it
+ * normally never crosses into user space.  Writes block on the
+ * slowest consumer, which in turn holds back the producer.  A
+ * consumer that goes away is simply dropped.
+ */
+
+struct fanout; // forward declaration
+
+/**
+ * Starts copying everything read from in to each of outs, in a
+ * background thread.
+ *
+ * All the file descriptors must refer to pipes.  The thread takes
+ * ownership of them and closes them when in reaches end-of-file or
+ * when no consumer is left.  On failure to start the thread, the
+ * descriptors are closed and an error is printed.
+ *
+ * @param in  read end of the producer's pipe
+ * @param outs  write ends of the consumers' pipes
+ * @param n  number of consumers
+ * @return a handle for fanout_wait(), or NULL on failure
+ */
+struct fanout *fanout_start(int in, const int *outs, int n);
+
+/**
+ * Waits for a fan-out to complete and frees it.
+ *
+ * @param f  handle returned by fanout_start(), or NULL
+ */
+void fanout_wait(struct fanout *f);
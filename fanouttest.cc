@@ -0,0 +1,134 @@
+#include <bandit/bandit.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "fanout.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * How a consumer reads its pipe.
+ */
+struct consumer {
+    long limit;             ///< bytes to read before leaving, or -1 for all
+    int slow;               ///< non-zero to pause between small reads
+};
+
+static const consumer ALL = { -1, 0 };
+static const consumer SLOW = { -1, 1 };
+static const consumer NEVER = { 0, 0 };
+
+/**
+ * Returns bytes that differ from one position to the next, so that
+ * lost or reordered data shows.
+ */
+static std::string make_input(size_t size) {
+    std::string input;
+    for (long i = 0; input.size() < size; ++i) input += std::to_string(i) + "\n";
+    return input;
+}
+
+/**
+ * Fans input out to the consumers, returning what each one read.
+ */
+static std::vector<std::string> run_fanout(const std::string &input,
+                                           const std::vector<consumer> &consumers) {
+    // Writing to a consumer that left must fail, not kill.
+    signal(SIGPIPE, SIG_IGN);
+    int in[2];
+    AssertThat(pipe(in), Equals(0));
+    size_t n = consumers.size();
+    std::vector<int> outs(n), ends(n);
+    for (size_t i = 0; i < n; ++i) {
+        int p[2];
+        AssertThat(pipe(p), Equals(0));
+        ends[i] = p[0];
+        outs[i] = p[1];
+        if (consumers[i].limit == 0) close(p[0]);
+    }
+    struct fanout *f = fanout_start(in[0], outs.data(), n);
+    AssertThat(f, !IsNull());
+
+    std::thread producer([&]() {
+            size_t done = 0;
+            while (done < input.size()) {
+                ssize_t m = write(in[1], input.data() + done, input.size() - done);
+                if (m < 0 && errno == EINTR) continue;
+                if (m < 0) break;
+                done += m;
+            }
+            close(in[1]);
+        });
+    std::vector<std::string> received(n);
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < n; ++i) {
+        if (consumers[i].limit == 0) continue;
+        readers.emplace_back([&, i]() {
+                const consumer &c = consumers[i];
+                char buffer[65536];
+                size_t size = c.slow ? 4096 : sizeof(buffer);
+                for (;;) {
+                    if (c.limit >= 0 && (long) received[i].size() >= c.limit) break;
+                    if (c.limit >= 0 && c.limit - (long) received[i].size() < (long) size)
+                        size = c.limit - received[i].size();
+                    ssize_t m = read(ends[i], buffer, size);
+                    if (m < 0 && errno == EINTR) continue;
+                    if (m <= 0) break;
+                    received[i].append(buffer, m);
+                    if (c.slow) usleep(200);
+                }
+                close(ends[i]);
+            });
+    }
+    for (std::thread &t : readers) t.join();
+    producer.join();
+    fanout_wait(f);
+    return received;
+}
+
+go_bandit([]() {
+        describe("fanout", []() {
+                it("copying everything to every consumer", [&]() {
+                        std::string input = make_input(1 << 20);
+                        std::vector<std::string> r = run_fanout(input, { ALL, ALL, ALL });
+                        for (const std::string &s : r) AssertThat(s == input, Equals(true));
+                    });
+                it("copying everything past a slow consumer", [&]() {
+                        // A slow first consumer makes tee() copy partial chunks.
+                        std::string input = make_input(1 << 20);
+                        std::vector<std::string> r = run_fanout(input, { SLOW, ALL, ALL });
+                        for (const std::string &s : r) AssertThat(s == input, Equals(true));
+                        r = run_fanout(input, { ALL, SLOW });
+                        for (const std::string &s : r) AssertThat(s == input, Equals(true));
+                    });
+                it("dropping consumers that leave early", [&]() {
+                        std::string input = make_input(1 << 20);
+                        consumer early = { 100000, 0 };
+                        std::vector<std::string> r = run_fanout(input, { early, SLOW, early });
+                        AssertThat(r[0] == input.substr(0, 100000), Equals(true));
+                        AssertThat(r[1] == input, Equals(true));
+                        AssertThat(r[2] == input.substr(0, 100000), Equals(true));
+                    });
+                it("dropping consumers that never read", [&]() {
+                        std::string input = make_input(1 << 20);
+                        std::vector<std::string> r = run_fanout(input, { NEVER, ALL, NEVER });
+                        AssertThat(r[1] == input, Equals(true));
+                        r = run_fanout(input, { ALL, NEVER });
+                        AssertThat(r[0] == input, Equals(true));
+                    });
+                it("ending once no consumer is left", [&]() {
+                        std::string input = make_input(1 << 20);
+                        consumer early = { 1000, 0 };
+                        std::vector<std::string> r = run_fanout(input, { early, NEVER });
+                        AssertThat(r[0] == input.substr(0, 1000), Equals(true));
+                    });
+            });
+    });
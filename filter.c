@@ -0,0 +1,354 @@
+/**
+ * Support for built-in filters.
+ *
+ * Each filter runs in its own thread over a reader and a writer
+ * buffering its endpoints.  The writer is flushed whenever the reader
+ * is about to wait for more input, so that output flows as promptly
+ * as with the line-buffered external commands on slow inputs while
+ * staying block-buffered on fast ones.
+ */
+
+#define _GNU_SOURCE
+
+#include "filter.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "error.h"
+#include "number.h"
+#include "ring.h"
+#include "thread.h"
+
+/**
+ * The size of the reader and writer buffers.
+ */
+#define BUFFER 65536
+
+/**
+ * A list of the different built-in filters.
+ */
+typedef enum {
+    FILTER_WC_LINES,        ///< wc -l
+    FILTER_WC_BYTES,        ///< wc -c
+    FILTER_HEAD,            ///< head
+    FILTER_GREP,            ///< grep
+} filter_kind_t;
+
+/**
+ * This structure represents a built-in filter.
+ */
+typedef struct filter {
+    filter_kind_t kind;     ///< which filter
+    long limit;             ///< number of lines, for head
+    int invert;             ///< non-zero to select non-matching lines, for grep
+    const char *pattern;    ///< regular expression, for grep
+    endpoint_t in;          ///< where to read from
+    endpoint_t out;         ///< where to write to
+    pthread_t thread;       ///< thread running the filter
+    int started;            ///< non-zero if thread was created
+    int status;             ///< exit status
+} filter_t;
+
+/**
+ * This structure buffers the output of a filter.
+ */
+typedef struct {
+    endpoint_t *ep;         ///< where to write to
+    char *data;             ///< BUFFER bytes
+    size_t length;          ///< number of bytes pending
+    int broken;             ///< non-zero if the consumer went away
+} writer_t;
+
+/**
+ * This structure buffers the input of a filter.
+ */
+typedef struct {
+    endpoint_t *ep;         ///< where to read from
+    char *data;             ///< size bytes plus one for a terminator
+    size_t size;            ///< usable size of data
+    size_t start;           ///< beginning of unconsumed bytes
+    size_t end;             ///< end of unconsumed bytes
+    int eof;                ///< non-zero once end-of-file is reached
+    writer_t *w;            ///< writer to flush before waiting for input
+} reader_t;
+
+static int parse_args(char **argv, filter_t *f);
+static void *run(void *arg);
+static int run_wc(filter_t *f, reader_t *r, writer_t *w);
+static int run_head(filter_t *f, reader_t *r, writer_t *w);
+static int run_grep(filter_t *f, reader_t *r, writer_t *w);
+static char *read_line(reader_t *r, size_t *length);
+static int fill(reader_t *r);
+static void put(writer_t *w, const char *data, size_t length);
+static void flush(writer_t *w);
+static void close_endpoints(filter_t *f);
+
+
+int is_filter(char **argv) {
+    filter_t f;
+    return parse_args(argv, &f);
+}
+
+filter_t *filter_start(char **argv, endpoint_t in, endpoint_t out) {
+    filter_t *f = alloc(sizeof(filter_t));
+    parse_args(argv, f);
+    f->in = in;
+    f->out = out;
+    f->status = 1;
+
+    int rc = start_thread(&f->thread, run, f);
+
+    f->started = rc == 0;
+    if (!f->started) {
+        err_with_errnum(argv[0], rc);
+        close_endpoints(f);
+    }
+    return f;
+}
+
+int filter_wait(filter_t *f) {
+    if (f->started) pthread_join(f->thread, NULL);
+    int status = f->status;
+    dealloc(f);
+    return status;
+}
+
+
+/**
+ * Recognizes the forms of built-in filters.
+ *
+ * @return non-zero if argv is a built-in filter, described in f
+ */
+static int parse_args(char **argv, filter_t *f) {
+    f->limit = 10;
+    f->invert = 0;
+    f->pattern = NULL;
+
+    if (strcmp(argv[0], "wc") == 0) {
+        if (argv[1] == NULL || argv[2] != NULL) return 0;
+        if (strcmp(argv[1], "-l") == 0)      f->kind = FILTER_WC_LINES;
+        else if (strcmp(argv[1], "-c") == 0) f->kind = FILTER_WC_BYTES;
+        else return 0;
+        return 1;
+    }
+    if (strcmp(argv[0], "head") == 0) {
+        f->kind = FILTER_HEAD;
+        if (argv[1] == NULL) return 1;
+        if (strcmp(argv[1], "-n") == 0)
+            return argv[2] != NULL && argv[3] == NULL
+                && parse_count(argv[2], &f->limit);
+        return argv[1][0] == '-' && argv[2] == NULL
+            && parse_count(argv[1] + 1, &f->limit);
+    }
+    if (strcmp(argv[0], "grep") == 0) {
+        f->kind = FILTER_GREP;
+        int i = 1;
+        if (argv[i] != NULL && strcmp(argv[i], "-v") == 0) {
+            f->invert = 1;
+            ++i;
+        }
+        if (argv[i] == NULL || argv[i + 1] != NULL || argv[i][0] == '-')
+            return 0;
+        f->pattern = argv[i];
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * The body of a filter thread.
+ */
+static void *run(void *arg) {
+    filter_t *f = arg;
+    writer_t w = { &f->out, alloc(BUFFER), 0, 0 };
+    reader_t r = { &f->in, alloc(BUFFER + 1), BUFFER, 0, 0, 0, &w };
+
+    switch (f->kind) {
+    case FILTER_WC_LINES:
+    case FILTER_WC_BYTES:
+        f->status = run_wc(f, &r, &w);
+        break;
+    case FILTER_HEAD:
+        f->status = run_head(f, &r, &w);
+        break;
+    case FILTER_GREP:
+        f->status = run_grep(f, &r, &w);
+        break;
+    }
+    flush(&w);
+    // Like a process killed by SIGPIPE.
+    if (w.broken) f->status = 128 + SIGPIPE;
+
+    close_endpoints(f);
+    dealloc(r.data);
+    dealloc(w.data);
+    return NULL;
+}
+
+static int run_wc(filter_t *f, reader_t *r, writer_t *w) {
+    unsigned long count = 0;
+    while (fill(r)) {
+        if (f->kind == FILTER_WC_BYTES) {
+            count += r->end - r->start;
+        } else {
+            const char *p = r->data + r->start;
+            const char *end = r->data + r->end;
+            while ((p = memchr(p, '\n', end - p)) != NULL) {
+                ++count;
+                ++p;
+            }
+        }
+        r->start = r->end;
+    }
+    char line[32];
+    int n = snprintf(line, sizeof(line), "%lu\n", count);
+    put(w, line, n);
+    return 0;
+}
+
+static int run_head(filter_t *f, reader_t *r, writer_t *w) {
+    char *line;
+    size_t length;
+    for (long i = 0; i < f->limit && !w->broken; ++i) {
+        if ((line = read_line(r, &length)) == NULL) break;
+        put(w, line, length);
+    }
+    return 0;
+}
+
+static int run_grep(filter_t *f, reader_t *r, writer_t *w) {
+    regex_t re;
+    int rc = regcomp(&re, f->pattern, REG_NOSUB);
+    if (rc != 0) {
+        char message[128] = "grep: ";
+        regerror(rc, &re, message + strlen(message),
+                 sizeof(message) - strlen(message));
+        err_with_message(message);
+        return 2;
+    }
+
+    int selected = 0;
+    char *line;
+    size_t length;
+    while (!w->broken && (line = read_line(r, &length)) != NULL) {
+        // Match the line without its newline, in place.
+        int newline = line[length - 1] == '\n';
+        char saved = line[length - newline];
+        line[length - newline] = '\0';
+        int match = regexec(&re, line, 0, NULL, 0) == 0;
+        line[length - newline] = saved;
+
+        if (match != f->invert) {
+            selected = 1;
+            put(w, line, length);
+            if (!newline) put(w, "\n", 1);
+        }
+    }
+    regfree(&re);
+    return selected ? 0 : 1;
+}
+
+/**
+ * Returns the next line, including its newline if any, or NULL at
+ * end-of-file.  The line stays valid until the next call.
+ */
+static char *read_line(reader_t *r, size_t *length) {
+    for (;;) {
+        char *line = r->data + r->start;
+        char *newline = memchr(line, '\n', r->end - r->start);
+        if (newline != NULL || (r->eof && r->end > r->start)) {
+            *length = newline != NULL ? (size_t) (newline + 1 - line)
+                                      : r->end - r->start;
+            r->start += *length;
+            return line;
+        }
+        if (!fill(r)) return NULL;
+    }
+}
+
+/**
+ * Reads more input after the unconsumed bytes, making room first.
+ *
+ * @return non-zero if some input is unconsumed
+ */
+static int fill(reader_t *r) {
+    if (r->eof) return r->end > r->start;
+
+    if (r->start > 0) {
+        memmove(r->data, r->data + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->end == r->size) {
+        r->size *= 2;
+        r->data = realloc_array(r->data, r->size + 1, 1);
+    }
+
+    flush(r->w);
+    ssize_t n;
+    if (r->ep->ring != NULL) {
+        n = ring_read(r->ep->ring, r->data + r->end, r->size - r->end);
+    } else {
+        while ((n = read(r->ep->fd, r->data + r->end, r->size - r->end)) < 0
+               && errno == EINTR)
+            ;
+        if (n < 0) err_with_errno("read");
+    }
+    if (n <= 0) r->eof = 1;
+    else        r->end += n;
+    return r->end > r->start;
+}
+
+/**
+ * Appends bytes to the output, flushing as needed.
+ */
+static void put(writer_t *w, const char *data, size_t length) {
+    while (length > 0 && !w->broken) {
+        size_t n = BUFFER - w->length < length ? BUFFER - w->length : length;
+        memcpy(w->data + w->length, data, n);
+        w->length += n;
+        data += n;
+        length -= n;
+        if (w->length == BUFFER) flush(w);
+    }
+}
+
+/**
+ * Writes the pending output.
+ */
+static void flush(writer_t *w) {
+    size_t done = 0;
+    if (w->ep->ring != NULL) {
+        done = ring_write(w->ep->ring, w->data, w->length);
+        if (done < w->length) w->broken = 1;
+    } else {
+        while (done < w->length && !w->broken) {
+            ssize_t n = write(w->ep->fd, w->data + done, w->length - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                if (errno != EPIPE) err_with_errno("write");
+                w->broken = 1;
+            } else {
+                done += n;
+            }
+        }
+    }
+    w->length = 0;
+}
+
+/**
+ * Releases both endpoints, letting the neighbours see the end.
+ */
+static void close_endpoints(filter_t *f) {
+    if (f->in.ring != NULL) ring_close_reader(f->in.ring);
+    else if (f->in.owned)   close(f->in.fd);
+    if (f->out.ring != NULL) ring_close_writer(f->out.ring);
+    else if (f->out.owned)   close(f->out.fd);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+/**
+ * Support for built-in filters: simple commands run as threads of the
+ * shell rather than as processes.  Following are the recognized
+ * forms; any other form runs the external command of the same name:
+ *
+ *    wc -l | wc -c
+ *    head [ -n N | -N ]
+ *    grep [ -v ] PATTERN
+ *
+ * The filters behave like their external counterparts reading their
+ * standard input.  PATTERN is a basic regular expression.
+ *
+ * A filter reads from and writes to endpoints, each being either a
+ * file descriptor or a ring (see ring.h) shared with an adjacent
+ * filter, which saves the fork(), exec() and pipe copies for chains
+ * of built-in stages.
+ */
+
+struct ring; // forward declaration
+struct filter; // forward declaration
+
+/**
+ * One end of a filter: a file descriptor, or a ring if ring is non-NULL.
+ */
+typedef struct {
+    int fd;                 ///< file descriptor, if ring is NULL
+    int owned;              ///< non-zero if the filter must close fd
+    struct ring *ring;      ///< if non-NULL, ring to use instead of fd
+} endpoint_t;
+
+/**
+ * Tells whether a command is a built-in filter.
+ *
+ * @param argv  null-terminated arguments of the command
+ * @return non-zero if the command has one of the forms above
+ */
+int is_filter(char **argv);
+
+/**
+ * Starts a built-in filter in a new thread.
+ *
+ * The filter takes ownership of both endpoints: it closes the rings
+ * and the owned file descriptors when done.  On failure to start the
+ * thread, an error is printed, the endpoints are closed and the
+ * filter ends at once with status 1.
+ *
+ * On unrecoverable errors this function calls die_with_message().
+ *
+ * @param argv  arguments of a command accepted by is_filter()
+ * @param in  where the filter reads from
+ * @param out  where the filter writes to
+ * @return a handle for filter_wait()
+ */
+struct filter *filter_start(char **argv, endpoint_t in, endpoint_t out);
+
+/**
+ * Waits for a filter to end and frees it.
+ *
+ * @param f  handle returned by filter_start()
+ * @return the exit status of the filter
+ */
+int filter_wait(struct filter *f);
@@ -0,0 +1,179 @@
+#include <bandit/bandit.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "filter.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * The output and exit status of a filter.
+ */
+struct result {
+    std::string output;
+    int status;
+};
+
+/**
+ * Splits a command into null-terminated words, pointing into words.
+ */
+static std::vector<char *> split(std::string &words) {
+    std::vector<char *> argv;
+    for (size_t i = 0; i < words.size(); ++i) {
+        if (words[i] == ' ') {
+            words[i] = '\0';
+        } else if (i == 0 || words[i - 1] == '\0') {
+            argv.push_back(&words[i]);
+        }
+    }
+    argv.push_back(NULL);
+    return argv;
+}
+
+/**
+ * Tells whether a command is a built-in filter.
+ */
+static int accepts(std::string command) {
+    return is_filter(split(command).data());
+}
+
+/**
+ * Runs a filter over pipes, feeding it input repeated count times.
+ *
+ * @param fed  if non-NULL, set to the number of times input was fully
+ *     written before the filter closed its input
+ */
+static result run_filter(std::string command, const std::string &input,
+                         long count = 1, long *fed = NULL) {
+    // Writing to a filter that stopped reading must fail, not kill.
+    signal(SIGPIPE, SIG_IGN);
+    int in[2], out[2];
+    AssertThat(pipe(in), Equals(0));
+    AssertThat(pipe(out), Equals(0));
+    endpoint_t from = { in[0], 1, NULL }, to = { out[1], 1, NULL };
+    struct filter *f = filter_start(split(command).data(), from, to);
+
+    std::thread producer([&]() {
+            long i = 0;
+            for (; i < count; ++i) {
+                size_t done = 0;
+                while (done < input.size()) {
+                    ssize_t n = write(in[1], input.data() + done, input.size() - done);
+                    if (n < 0 && errno == EINTR) continue;
+                    if (n < 0) break;
+                    done += n;
+                }
+                if (done < input.size()) break;
+            }
+            if (fed != NULL) *fed = i;
+            close(in[1]);
+        });
+    result r;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(out[0], buffer, sizeof(buffer))) > 0) r.output.append(buffer, n);
+    close(out[0]);
+    producer.join();
+    r.status = filter_wait(f);
+    return r;
+}
+
+go_bandit([]() {
+        describe("is_filter", []() {
+                it("accepting the supported forms", [&]() {
+                        AssertThat(accepts("wc -l"), !Equals(0));
+                        AssertThat(accepts("wc -c"), !Equals(0));
+                        AssertThat(accepts("head"), !Equals(0));
+                        AssertThat(accepts("head -n 3"), !Equals(0));
+                        AssertThat(accepts("head -3"), !Equals(0));
+                        AssertThat(accepts("grep a.b"), !Equals(0));
+                        AssertThat(accepts("grep -v a.b"), !Equals(0));
+                    });
+                it("rejecting unsupported flags and operands", [&]() {
+                        AssertThat(accepts("wc"), Equals(0));
+                        AssertThat(accepts("wc -w"), Equals(0));
+                        AssertThat(accepts("wc -l file"), Equals(0));
+                        AssertThat(accepts("head -c 3"), Equals(0));
+                        AssertThat(accepts("head -n x"), Equals(0));
+                        AssertThat(accepts("head -n 3 file"), Equals(0));
+                        AssertThat(accepts("grep"), Equals(0));
+                        AssertThat(accepts("grep -i a"), Equals(0));
+                        AssertThat(accepts("grep -v -i a"), Equals(0));
+                        AssertThat(accepts("grep a file"), Equals(0));
+                        AssertThat(accepts("sort"), Equals(0));
+                    });
+            });
+
+        describe("wc", []() {
+                it("counting lines and bytes", [&]() {
+                        result r = run_filter("wc -l", "a\nb\nc\n");
+                        AssertThat(r.output, Equals("3\n"));
+                        AssertThat(r.status, Equals(0));
+                        AssertThat(run_filter("wc -c", "a\nb\nc\n").output, Equals("6\n"));
+                        AssertThat(run_filter("wc -l", "").output, Equals("0\n"));
+                    });
+                it("not counting a last line without a newline", [&]() {
+                        AssertThat(run_filter("wc -l", "a\nb").output, Equals("1\n"));
+                        AssertThat(run_filter("wc -c", "a\nb").output, Equals("3\n"));
+                    });
+            });
+
+        describe("head", []() {
+                it("copying the first lines", [&]() {
+                        AssertThat(run_filter("head -n 2", "a\nb\nc\n").output, Equals("a\nb\n"));
+                        AssertThat(run_filter("head -2", "a\nb\nc\n").output, Equals("a\nb\n"));
+                        AssertThat(run_filter("head", "1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n").output,
+                                   Equals("1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n"));
+                        AssertThat(run_filter("head -n 5", "a\nb").output, Equals("a\nb"));
+                    });
+                it("copying nothing with -n 0", [&]() {
+                        result r = run_filter("head -n 0", "a\nb\n");
+                        AssertThat(r.output, Equals(""));
+                        AssertThat(r.status, Equals(0));
+                    });
+                it("stopping early on a long input", [&]() {
+                        long fed;
+                        result r = run_filter("head -n 2", "a\nb\nc\n", 1L << 24, &fed);
+                        AssertThat(r.output, Equals("a\nb\n"));
+                        AssertThat(r.status, Equals(0));
+                        AssertThat(fed < (1L << 24), Equals(true));
+                    });
+            });
+
+        describe("grep", []() {
+                it("selecting matching lines", [&]() {
+                        result r = run_filter("grep b.", "abc\nbd\nxb\n");
+                        AssertThat(r.output, Equals("abc\nbd\n"));
+                        AssertThat(r.status, Equals(0));
+                    });
+                it("selecting non-matching lines with -v", [&]() {
+                        result r = run_filter("grep -v a", "a\nb\nab\nc\n");
+                        AssertThat(r.output, Equals("b\nc\n"));
+                        AssertThat(r.status, Equals(0));
+                    });
+                it("matching a line longer than the read buffer", [&]() {
+                        std::string line = std::string(200000, 'x') + "needle\n";
+                        result r = run_filter("grep needle", "short\n" + line + "short\n");
+                        AssertThat(r.output == line, Equals(true));
+                        AssertThat(r.status, Equals(0));
+                    });
+                it("ending a last line without a newline", [&]() {
+                        AssertThat(run_filter("grep b", "a\nb").output, Equals("b\n"));
+                        AssertThat(run_filter("grep -v a", "a\nb").output, Equals("b\n"));
+                    });
+                it("exiting with 1 when no line is selected", [&]() {
+                        result r = run_filter("grep z", "a\nb\n");
+                        AssertThat(r.output, Equals(""));
+                        AssertThat(r.status, Equals(1));
+                        AssertThat(run_filter("grep -v .", "a\nb\n").status, Equals(1));
+                    });
+            });
+    });
@@ -0,0 +1,174 @@
+/**
+ * Support for live metrics.
+ *
+ * The fields are only modified inside a write section of the
+ * sequence lock, so plain stores suffice; the fences order them with
+ * respect to the sequence.
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * How many times to retry a busy sequence before giving up.
+ */
+#define RETRIES 1000
+
+/**
+ * The published metrics, or NULL.
+ */
+static metrics_t *published;
+
+static int begin(metrics_t *m, uint64_t *sequence);
+static void end(metrics_t *m, uint64_t sequence);
+static int bucket(uint64_t us);
+
+
+int metrics_publish(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, sizeof(metrics_t)) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    metrics_t *m = mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    int saved = errno;
+    close(fd);
+    if (m == MAP_FAILED) {
+        errno = saved;
+        return -1;
+    }
+
+    // The file is all zeros; the magic number comes last.
+    m->pid = getpid();
+    __atomic_store_n(&m->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    published = m;
+    return 0;
+}
+
+void metrics_count(metric_counter_t c, uint64_t n) {
+    uint64_t sequence;
+    if (!begin(published, &sequence)) return;
+    published->counters[c] += n;
+    end(published, sequence);
+}
+
+void metrics_record(metric_histogram_t h, uint64_t us) {
+    uint64_t sequence;
+    if (!begin(published, &sequence)) return;
+    histogram_t *hist = &published->histograms[h];
+    ++hist->count;
+    hist->sum += us;
+    ++hist->buckets[bucket(us)];
+    end(published, sequence);
+}
+
+uint64_t metrics_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+const metrics_t *metrics_map(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size != (off_t) sizeof(metrics_t)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    const metrics_t *m = mmap(NULL, sizeof(metrics_t), PROT_READ, MAP_SHARED, fd, 0);
+    int saved = errno;
+    close(fd);
+    if (m == MAP_FAILED) {
+        errno = saved;
+        return NULL;
+    }
+    if (__atomic_load_n(&m->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC) {
+        munmap((void *) m, sizeof(metrics_t));
+        errno = EINVAL;
+        return NULL;
+    }
+    return m;
+}
+
+int metrics_snapshot(const metrics_t *m, metrics_t *copy) {
+    for (int i = 0; i < RETRIES; ++i) {
+        uint64_t before = __atomic_load_n(&m->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, (const void *) m, sizeof(metrics_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m->sequence, __ATOMIC_RELAXED) == before) return 0;
+    }
+    return -1;
+}
+
+uint64_t metrics_percentile(const histogram_t *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t) (p / 100 * h->count + 0.999999);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    int i = 0;
+    for (; i < METRICS_BUCKETS - 1; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank) break;
+    }
+    return (uint64_t) 1 << i;
+}
+
+
+/**
+ * Enters a write section, making the sequence odd.
+ *
+ * @return non-zero on success, 0 if m is NULL or stays busy
+ */
+static int begin(metrics_t *m, uint64_t *sequence) {
+    if (m == NULL) return 0;
+    uint64_t s = __atomic_load_n(&m->sequence, __ATOMIC_RELAXED);
+    for (int i = 0; i < RETRIES; ++i) {
+        if ((s & 1) == 0
+            && __atomic_compare_exchange_n(&m->sequence, &s, s + 1, 0,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            // Readers must see the odd sequence before any new value.
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            *sequence = s + 1;
+            return 1;
+        }
+        if (s & 1) {
+            sched_yield();
+            s = __atomic_load_n(&m->sequence, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Leaves a write section, making the sequence even again.
+ */
+static void end(metrics_t *m, uint64_t sequence) {
+    __atomic_store_n(&m->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns the bucket of a duration.
+ */
+static int bucket(uint64_t us) {
+    int i = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    return i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Support for live metrics published by the shell in a memory-mapped
+ * file, which monitoring tools such as shellstat read without
+ * stopping or signalling the shell.
+ *
+ * The file holds one metrics_t structure guarded by a sequence lock:
+ * a writer makes the sequence odd, updates the fields, then makes it
+ * even again; a reader copies the structure and retries if the
+ * sequence was odd or changed meanwhile.  Writers take the sequence
+ * from even to odd with a compare-and-swap so that the workers of a
+ * server (see server.h), which share the file, exclude each other.
+ * Neither side ever blocks on the other for long: a writer that
+ * cannot get the sequence drops its update, and a reader gives up.
+ */
+
+/**
+ * Identifies a metrics file and its layout.
+ */
+#define METRICS_MAGIC 0x3130544154534853ULL    // "SHSTAT01"
+
+/**
+ * The number of buckets of a histogram.  Bucket 0 counts values of 0
+ * microseconds, bucket i those in [2^(i-1), 2^i) microseconds, and
+ * the last bucket all larger values.
+ */
+#define METRICS_BUCKETS 32
+
+/**
+ * The counters.
+ */
+typedef enum {
+    METRIC_PIPELINES,       ///< pipelines executed
+    METRIC_STAGES,          ///< processes forked for pipeline stages
+    METRIC_EXEC_FAILURES,   ///< stages whose exec failed
+    METRIC_PARSE_ERRORS,    ///< lines rejected by the parser
+    METRIC_COUNTERS,        ///< number of counters
+} metric_counter_t;
+
+/**
+ * The histograms, of durations in microseconds.
+ */
+typedef enum {
+    METRIC_PARSE,           ///< parsing or compiling a line
+    METRIC_FORK_EXEC,       ///< from fork() to the exec of a stage
+    METRIC_WALL,            ///< wall time of a pipeline
+    METRIC_HISTOGRAMS,      ///< number of histograms
+} metric_histogram_t;
+
+/**
+ * A histogram of durations.
+ */
+typedef struct {
+    uint64_t count;                     ///< number of values
+    uint64_t sum;                       ///< sum of the values
+    uint64_t buckets[METRICS_BUCKETS];  ///< number of values per bucket
+} histogram_t;
+
+/**
+ * The content of a metrics file.
+ */
+typedef struct {
+    uint64_t magic;                                 ///< METRICS_MAGIC
+    uint64_t pid;                                   ///< process publishing
+    uint64_t sequence;                              ///< odd while updated
+    uint64_t counters[METRIC_COUNTERS];             ///< counters
+    histogram_t histograms[METRIC_HISTOGRAMS];      ///< histograms
+} metrics_t;
+
+/**
+ * Starts publishing the metrics of this process in a file.
+ *
+ * The file is created or truncated.  Until this function succeeds,
+ * the updates below do nothing.
+ *
+ * @param path  name of the file
+ * @return 0 on success, else -1 with errno set
+ */
+int metrics_publish(const char *path);
+
+/**
+ * Adds to a counter.
+ */
+void metrics_count(metric_counter_t c, uint64_t n);
+
+/**
+ * Adds a duration to a histogram.
+ *
+ * @param h  histogram
+ * @param us  duration in microseconds
+ */
+void metrics_record(metric_histogram_t h, uint64_t us);
+
+/**
+ * Returns a monotonic time in microseconds, for durations.
+ */
+uint64_t metrics_now(void);
+
+/**
+ * Maps a metrics file for reading.
+ *
+ * @param path  name of the file
+ * @return the mapped metrics, or NULL with errno set; EINVAL means the
+ *     file is not a metrics file
+ */
+const metrics_t *metrics_map(const char *path);
+
+/**
+ * Copies consistent metrics.
+ *
+ * @param m  mapped metrics
+ * @param copy  where to copy them
+ * @return 0 on success, else -1 if a writer kept them busy
+ */
+int metrics_snapshot(const metrics_t *m, metrics_t *copy);
+
+/**
+ * Estimates a percentile of a histogram.
+ *
+ * @param h  histogram
+ * @param p  percentile, in (0, 100]
+ * @return the exclusive upper bound of the bucket holding the
+ *     percentile, in microseconds, i.e. 1 for bucket 0 and 2^i for
+ *     bucket i, or 0 if the histogram is empty
+ */
+uint64_t metrics_percentile(const histogram_t *h, double p);
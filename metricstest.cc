@@ -0,0 +1,68 @@
+#include <bandit/bandit.h>
+
+extern "C" {
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "metrics.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+go_bandit([]() {
+        describe("metrics", []() {
+                it("publishing counters and histograms", [&]() {
+                        char path[] = "/tmp/metricstestXXXXXX";
+                        close(mkstemp(path));
+                        AssertThat(metrics_publish(path), Equals(0));
+                        metrics_count(METRIC_PIPELINES, 1);
+                        metrics_count(METRIC_PIPELINES, 2);
+                        metrics_count(METRIC_PARSE_ERRORS, 1);
+                        metrics_record(METRIC_WALL, 0);
+                        metrics_record(METRIC_WALL, 5);
+                        metrics_record(METRIC_WALL, 1000);
+
+                        const metrics_t *m = metrics_map(path);
+                        AssertThat(m, !IsNull());
+                        metrics_t copy;
+                        AssertThat(metrics_snapshot(m, &copy), Equals(0));
+                        AssertThat(copy.pid, Equals((uint64_t) getpid()));
+                        AssertThat(copy.sequence % 2, Equals(0u));
+                        AssertThat(copy.counters[METRIC_PIPELINES], Equals(3u));
+                        AssertThat(copy.counters[METRIC_PARSE_ERRORS], Equals(1u));
+                        AssertThat(copy.counters[METRIC_STAGES], Equals(0u));
+                        const histogram_t *h = &copy.histograms[METRIC_WALL];
+                        AssertThat(h->count, Equals(3u));
+                        AssertThat(h->sum, Equals(1005u));
+                        AssertThat(h->buckets[0], Equals(1u));
+                        AssertThat(h->buckets[3], Equals(1u));
+                        AssertThat(h->buckets[10], Equals(1u));
+                        unlink(path);
+                    });
+                it("rejecting a file of another kind", [&]() {
+                        char path[] = "/tmp/metricstestXXXXXX";
+                        int fd = mkstemp(path);
+                        AssertThat(write(fd, "hello", 5), Equals(5));
+                        close(fd);
+                        AssertThat(metrics_map(path), IsNull());
+                        AssertThat(errno, Equals(EINVAL));
+                        unlink(path);
+                    });
+            });
+
+        describe("metrics_percentile", []() {
+                it("bounding percentiles by bucket", [&]() {
+                        histogram_t h = {};
+                        AssertThat(metrics_percentile(&h, 50), Equals(0u));
+                        h.count = 100;
+                        h.buckets[0] = 10;
+                        h.buckets[4] = 80;
+                        h.buckets[12] = 10;
+                        AssertThat(metrics_percentile(&h, 10), Equals(1u));
+                        AssertThat(metrics_percentile(&h, 50), Equals(16u));
+                        AssertThat(metrics_percentile(&h, 90), Equals(16u));
+                        AssertThat(metrics_percentile(&h, 99), Equals(4096u));
+                    });
+            });
+    });
@@ -0,0 +1,17 @@
+/**
+ * Support for parsing numbers.
+ */
+
+#include "number.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+int parse_count(const char *s, long *count) {
+    if (s == NULL || *s == '\0') return 0;
+    for (const char *c = s; *c; ++c)
+        if (*c < '0' || *c > '9') return 0;
+    errno = 0;
+    *count = strtol(s, NULL, 10);
+    return errno == 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+/**
+ * Support for parsing the numbers given to builtins and filters.
+ */
+
+/**
+ * Parses a non-negative decimal number, digits only.
+ *
+ * @param s  a null-terminated character string, or NULL
+ * @param count  filled with the number
+ * @return non-zero if s is a number that fits in a long
+ */
+int parse_count(const char *s, long *count);
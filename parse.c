@@ -8,10 +8,16 @@
  * pipeline -> ε
  * pipeline -> command
  * pipeline -> pipeline '|' command
+ * pipeline -> pipeline '|{' branches '}'
+ * branches -> pipeline
+ * branches -> branches ';' pipeline
  * command -> simple_command
  * command -> simple_command '>' WORD
- * simple_command -> WORD
- * simple_command -> simple_command WORD
+ * simple_command -> word
+ * simple_command -> simple_command word
+ * word -> WORD
+ * word -> '$(' ')'
+ * word -> '$(' pipeline ')'
  *
  * To built a corresponding recursive descent parser, we must
  * transform the above grammar to an LL(1) equivalent grammar:
@@ -19,12 +25,20 @@
  * pipeline -> ε
  * pipeline -> command pipeline'
  * pipeline' -> '|' command pipeline'
+ * pipeline' -> '|{' branches '}'
  * pipeline' -> ε
+ * branches -> command pipeline' branches'
+ * branches' -> ';' command pipeline' branches'
+ * branches' -> ε
  * command -> simple_command
  * command -> simple_command '>' WORD
- * simple_command -> WORD simple_command'
- * simple_command' -> WORD simple_command'
+ * simple_command -> word simple_command'
+ * simple_command' -> word simple_command'
  * simple_command' -> ε
+ * word -> WORD
+ * word -> '$(' substitution
+ * substitution -> ')'
+ * substitution -> command pipeline' ')'
  *
  * For details of this transformation, see, for example, Introduction
  * to Compilers and Language Design, Douglas Thain, Second edition,
@@ -83,12 +97,12 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
 
 #include "alloc.h"
-#include "error.h"
 
 /**
  * A list of the different types of token observed during parsing.
@@ -99,6 +113,11 @@ typedef enum {
       TOKEN_PIPE,           ///< pipeline operator, i.e., '|'
       TOKEN_OUT_REDIRECT,   ///< output redirection, i.e., '<'
       TOKEN_IN_REDIRECT,    ///< input redirection, i.e., '>'
+      TOKEN_FANOUT,         ///< fan-out operator, i.e., '|{'
+      TOKEN_SEPARATOR,      ///< branch separator, i.e., ';' within '|{'
+      TOKEN_CLOSE,          ///< end of fan-out, i.e., '}' within '|{'
+      TOKEN_SUBST_OPEN,     ///< command substitution, i.e., '$('
+      TOKEN_SUBST_CLOSE,    ///< end of substitution, i.e., ')' within '$('
       TOKEN_WORD,           ///< a WORD
 } token_type_t;
 
@@ -118,28 +137,36 @@ typedef struct {
     token_t prev_token;         ///< putback token if type is not NONE
     root_t *root;               ///< pointer to the parsing state
     command_t *current_command; ///< command currently being parsed
+    command_t **link;           ///< where to link the next command
+    int depth;                  ///< number of enclosing fan-outs
+    int nesting;                ///< number of enclosing substitutions
+    int failed;                 ///< non-zero once memory ran out
 } parser_t;
 
 // Forward declaration of local functions.
-int parse_pipeline(parser_t *p);
-int parse_pipeline_prime(parser_t *p);
-int parse_command(parser_t *p);
-int parse_redirection(parser_t *p);
-int parse_redirection_prime(parser_t *p);
-int parse_redirection_double_prime(parser_t *p);
-int parse_simple_command(parser_t *p);
-int parse_simple_command_prime(parser_t *p);
-token_t get_token(parser_t *p);
-void putback_token(parser_t *p, token_t t);
-int expect_token(parser_t *p, token_type_t type);
-void add_root(parser_t *p);
-void add_command(parser_t *p);
-void add_word_to_command(parser_t *p, token_t t);
-void add_NULL_to_command(parser_t *p);
-void check_capacity(parser_t *p);
-void add_outfile(parser_t *p, token_t t);
-void add_infile(parser_t *p, token_t t);
-void free_command(struct command *c);
+static int parse_pipeline(parser_t *p);
+static int parse_pipeline_prime(parser_t *p);
+static int parse_branches(parser_t *p);
+static int parse_command(parser_t *p);
+static int parse_redirection(parser_t *p);
+static int parse_redirection_prime(parser_t *p);
+static int parse_redirection_double_prime(parser_t *p);
+static int parse_simple_command(parser_t *p);
+static int parse_simple_command_prime(parser_t *p);
+static int parse_word(parser_t *p);
+static int parse_substitution(parser_t *p, token_t t);
+static token_t get_token(parser_t *p);
+static void putback_token(parser_t *p, token_t t);
+static int expect_token(parser_t *p, token_type_t type);
+static int add_root(parser_t *p);
+static int add_command(parser_t *p);
+static int add_word_to_command(parser_t *p, token_t t);
+static substitution_t *add_substitution(parser_t *p);
+static int add_NULL_to_command(parser_t *p);
+static int check_capacity(parser_t *p);
+static void add_outfile(parser_t *p, token_t t);
+static void add_infile(parser_t *p, token_t t);
+static void free_command(struct command *c);
 
 
 root_t *parse(char *input) {
@@ -147,11 +174,22 @@ root_t *parse(char *input) {
 
     parser.input = input;
     parser.prev_token.type = TOKEN_NONE;
-    add_root(&parser);
+    if (!add_root(&parser)) return NULL;
     parser.current_command = NULL;
+    parser.link = &parser.root->first_command;
+    parser.depth = 0;
+    parser.nesting = 0;
+    parser.failed = 0;
 
     parser.root->valid = parse_pipeline(&parser);
 
+    // Every function gives up once memory ran out, leaving partial
+    // structures that parse_end() can free.
+    if (parser.failed) {
+        parse_end(parser.root);
+        errno = ENOMEM;
+        return NULL;
+    }
     return parser.root;
 }
 
@@ -160,42 +198,62 @@ void parse_end(struct root *r) {
     if (r->first_command != NULL) {
         free_command(r->first_command);
     }
-    free(r);
+    dealloc(r);
 }
 
 
-int parse_pipeline(parser_t *p) {
+static int parse_pipeline(parser_t *p) {
     token_t t = get_token(p);
     if (t.type == TOKEN_EOF) return 1;
     putback_token(p, t);
     if (!parse_command(p) || !parse_pipeline_prime(p))
         return 0;
-    if (expect_token(p, TOKEN_EOF)) {
-        add_NULL_to_command(p);
-        return 1;
-    }
-    return 0;
+    return expect_token(p, TOKEN_EOF) && add_NULL_to_command(p);
 }
 
-int parse_pipeline_prime(parser_t *p) {
+static int parse_pipeline_prime(parser_t *p) {
     token_t t = get_token(p);
     if (t.type == TOKEN_PIPE) {
-        add_NULL_to_command(p);
-        return parse_command(p) && parse_pipeline_prime(p);
+        return add_NULL_to_command(p) && parse_command(p)
+            && parse_pipeline_prime(p);
+    }
+    if (t.type == TOKEN_FANOUT) {
+        return add_NULL_to_command(p) && parse_branches(p);
     }
     putback_token(p, t);
     return 1;
 }
 
-int parse_command(parser_t *p) {
-    add_command(p);
+static int parse_branches(parser_t *p) {
+    command_t **link = &p->current_command->branches;
+    ++p->depth;
+    for (;;) {
+        p->link = link;
+        if (!parse_command(p) || !parse_pipeline_prime(p)
+            || !add_NULL_to_command(p))
+            return 0;
+        link = &(*link)->next_branch;
+
+        token_t t = get_token(p);
+        if (t.type == TOKEN_CLOSE) break;
+        if (t.type != TOKEN_SEPARATOR) {
+            putback_token(p, t);
+            return 0;
+        }
+    }
+    --p->depth;
+    return 1;
+}
+
+static int parse_command(parser_t *p) {
+    if (!add_command(p)) return 0;
     if (parse_simple_command(p)) {
       return parse_redirection(p);
     }
     return 0;
 }
 
-int parse_redirection(parser_t *p) {
+static int parse_redirection(parser_t *p) {
   token_t t = get_token(p);
   if (t.type == TOKEN_OUT_REDIRECT) {
     token_t t = get_token(p);
@@ -216,7 +274,7 @@ int parse_redirection(parser_t *p) {
   return 1;
 }
 
-int parse_redirection_prime(parser_t *p) {
+static int parse_redirection_prime(parser_t *p) {
   token_t t = get_token(p);
   if (t.type == TOKEN_IN_REDIRECT) {
     token_t t = get_token(p);
@@ -230,7 +288,7 @@ int parse_redirection_prime(parser_t *p) {
   return 1;
 }
 
-int parse_redirection_double_prime(parser_t *p) {
+static int parse_redirection_double_prime(parser_t *p) {
   token_t t = get_token(p);
   if (t.type == TOKEN_OUT_REDIRECT) {
     token_t t = get_token(p);
@@ -244,26 +302,60 @@ int parse_redirection_double_prime(parser_t *p) {
   return 1;
 }
 
-int parse_simple_command(parser_t *p) {
+static int parse_simple_command(parser_t *p) {
+    return parse_word(p) && parse_simple_command_prime(p);
+}
+
+static int parse_simple_command_prime(parser_t *p) {
     token_t t = get_token(p);
-    if (t.type == TOKEN_WORD) {
-        add_word_to_command(p, t);
-        return parse_simple_command_prime(p);
+    putback_token(p, t);
+    if (t.type == TOKEN_WORD || t.type == TOKEN_SUBST_OPEN) {
+        return parse_word(p) && parse_simple_command_prime(p);
     }
-    return 0;
+    return 1;
 }
 
-int parse_simple_command_prime(parser_t *p) {
+static int parse_word(parser_t *p) {
     token_t t = get_token(p);
     if (t.type == TOKEN_WORD) {
-        add_word_to_command(p, t);
-        return parse_simple_command_prime(p);
+        return add_word_to_command(p, t);
+    }
+    if (t.type == TOKEN_SUBST_OPEN) {
+        return parse_substitution(p, t);
     }
     putback_token(p, t);
-    return 1;
+    return 0;
+}
+
+static int parse_substitution(parser_t *p, token_t t) {
+    // The '$(' token holds the place of the words in argv.
+    substitution_t *s;
+    if (!add_word_to_command(p, t) || (s = add_substitution(p)) == NULL)
+        return 0;
+
+    // Parse the inner pipeline as a pipeline of its own, then resume
+    // the enclosing command.
+    command_t *c = p->current_command;
+    command_t **link = p->link;
+    int depth = p->depth;
+    p->link = &s->first_command;
+    p->depth = 0;
+    ++p->nesting;
+
+    int ok = expect_token(p, TOKEN_SUBST_CLOSE);
+    if (!ok && parse_command(p) && parse_pipeline_prime(p)
+        && add_NULL_to_command(p)) {
+        ok = expect_token(p, TOKEN_SUBST_CLOSE);
+    }
+
+    --p->nesting;
+    p->depth = depth;
+    p->link = link;
+    p->current_command = c;
+    return ok;
 }
 
-token_t get_token(parser_t *p) {
+static token_t get_token(parser_t *p) {
     token_t t;
 
     // Check for a recently putback token.
@@ -301,6 +393,16 @@ token_t get_token(parser_t *p) {
         t.type = TOKEN_OUT_REDIRECT;
     else if (strncmp(t.begin, "<", end - t.begin) == 0)
         t.type = TOKEN_IN_REDIRECT;
+    else if (strncmp(t.begin, "|{", end - t.begin) == 0)
+        t.type = TOKEN_FANOUT;
+    else if (p->depth > 0 && strncmp(t.begin, ";", end - t.begin) == 0)
+        t.type = TOKEN_SEPARATOR;
+    else if (p->depth > 0 && strncmp(t.begin, "}", end - t.begin) == 0)
+        t.type = TOKEN_CLOSE;
+    else if (end - t.begin == 2 && strncmp(t.begin, "$(", 2) == 0)
+        t.type = TOKEN_SUBST_OPEN;
+    else if (p->nesting > 0 && strncmp(t.begin, ")", end - t.begin) == 0)
+        t.type = TOKEN_SUBST_CLOSE;
     else
         t.type = TOKEN_WORD;
 
@@ -310,71 +412,120 @@ token_t get_token(parser_t *p) {
     return t;
 }
 
-void putback_token(parser_t *p, token_t t) {
+static void putback_token(parser_t *p, token_t t) {
     assert(p->prev_token.type == TOKEN_NONE && t.type != TOKEN_NONE);
     p->prev_token = t;
 }
 
-int expect_token(parser_t *p, token_type_t type) {
+static int expect_token(parser_t *p, token_type_t type) {
     token_t t = get_token(p);
     if (t.type == type) return 1;
     putback_token(p, t);
     return 0;
 }
 
-void add_root(parser_t *p) {
-    p->root = alloc(sizeof(root_t));
+// The add_ functions return zero, setting failed, when memory ran out.
+
+static int add_root(parser_t *p) {
+    p->root = try_alloc(sizeof(root_t));
+    if (p->root == NULL) return 0;
     p->root->valid = 0;
     p->root->first_command = NULL;
+    return 1;
 }
 
-void add_command(parser_t *p) {
-    command_t *c = alloc(sizeof(command_t));
-    c->argv = alloc(sizeof(char *));
+static int add_command(parser_t *p) {
+    command_t *c = try_alloc(sizeof(command_t));
+    char **argv = try_alloc(sizeof(char *));
+    if (c == NULL || argv == NULL) {
+        dealloc(c);
+        dealloc(argv);
+        p->failed = 1;
+        return 0;
+    }
+    c->argv = argv;
     c->argc = 0;
     c->capacity = 1;
     c->next = NULL;
     c->outfile = NULL;
     c->infile = NULL;
-    if (p->current_command == NULL) p->root->first_command = c;
-    else                            p->current_command->next = c;
+    c->branches = NULL;
+    c->next_branch = NULL;
+    c->substitutions = NULL;
+    *p->link = c;
+    p->link = &c->next;
     p->current_command = c;
+    return 1;
 }
 
-void add_word_to_command(parser_t *p, token_t t) {
-    check_capacity(p);
+static int add_word_to_command(parser_t *p, token_t t) {
+    if (!check_capacity(p)) return 0;
     p->current_command->argv[p->current_command->argc] = t.begin;
     ++p->current_command->argc;
+    return 1;
 }
 
-void add_NULL_to_command(parser_t *p) {
-    check_capacity(p);
+static substitution_t *add_substitution(parser_t *p) {
+    substitution_t *s = try_alloc(sizeof(substitution_t));
+    if (s == NULL) {
+        p->failed = 1;
+        return NULL;
+    }
+    s->index = p->current_command->argc - 1;
+    s->first_command = NULL;
+    s->next = NULL;
+
+    substitution_t **link = &p->current_command->substitutions;
+    while (*link != NULL) link = &(*link)->next;
+    *link = s;
+    return s;
+}
+
+static int add_NULL_to_command(parser_t *p) {
+    // The last command of a fan-out branch is already terminated.
+    command_t *c = p->current_command;
+    if (c->argc > 0 && c->argv[c->argc - 1] == NULL) return 1;
+    if (!check_capacity(p)) return 0;
     p->current_command->argv[p->current_command->argc] = NULL;
     ++p->current_command->argc;
+    return 1;
 }
 
-void check_capacity(parser_t *p) {
+static int check_capacity(parser_t *p) {
     int index = p->current_command->argc;
     assert(index <= p->current_command->capacity);
     if (index == p->current_command->capacity) {
-        p->current_command->argv = realloc_array(p->current_command->argv,
-                                                 2*p->current_command->capacity,
-                                                 sizeof(char *));
-        if (p->current_command->argv == NULL) die_with_errno(NULL);
+        char **argv = try_realloc_array(p->current_command->argv,
+                                        2*p->current_command->capacity,
+                                        sizeof(char *));
+        if (argv == NULL) {
+            p->failed = 1;
+            return 0;
+        }
+        p->current_command->argv = argv;
         p->current_command->capacity *= 2;
     }
+    return 1;
 }
 
-void add_outfile(parser_t *p, token_t t) {
+static void add_outfile(parser_t *p, token_t t) {
     p->current_command->outfile = t.begin;
 }
 
-void add_infile(parser_t *p, token_t t) {
+static void add_infile(parser_t *p, token_t t) {
     p->current_command->infile = t.begin;
 }
 
-void free_command(struct command *c) {
+static void free_command(struct command *c) {
     if (c->next != NULL) free_command(c->next);
-    if (c->argv != NULL) free(c->argv);
-    free(c);
+    if (c->branches != NULL) free_command(c->branches);
+    if (c->next_branch != NULL) free_command(c->next_branch);
+    while (c->substitutions != NULL) {
+        substitution_t *s = c->substitutions;
+        c->substitutions = s->next;
+        if (s->first_command != NULL) free_command(s->first_command);
+        dealloc(s);
+    }
+    if (c->argv != NULL) dealloc(c->argv);
+    dealloc(c);
 }
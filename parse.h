@@ -8,7 +8,20 @@
  * pipeline forms expressed with the convention used in the synopsis
  * section of man pages (see "man man"):
  *
- *    COMMAND [ > FILE ] [ | COMMAND [ > FILE ] ] ...
+ *    COMMAND [ > FILE ] [ | COMMAND [ > FILE ] ] ... [ |{ BRANCHES } ]
+ *
+ * where BRANCHES is one or more pipelines separated by ';' tokens.
+ * The fan-out operator '|{' feeds the output of the command before it
+ * to every branch.  The tokens ';' and '}' only have a meaning within
+ * a fan-out.
+ *
+ * Any WORD of a COMMAND may also be a command substitution:
+ *
+ *    $( [ PIPELINE ] )
+ *
+ * which stands for the words of the output of PIPELINE when the
+ * command runs.  Substitutions nest; the token ')' only has a meaning
+ * within a substitution.
  *
  * Each of the strings or tokens comprising the pipeline must be
  * separated by whitespaces and contained in a single line of
@@ -17,6 +30,7 @@
 
 struct root; // forward declaration
 struct command; // forward declaration
+struct substitution; // forward declaration
 
 /**
  * Breaks a character string into a linked list of commands suited for
@@ -35,10 +49,14 @@ struct command; // forward declaration
  * content pointed to by input and that this content will remain live
  * until the returned structures are freed.
  *
- * On unrecoverable errors this function calls die_with_errno(NULL).
+ * This function never exits the process and uses no global state, so
+ * that threads may parse concurrently (see libshparse in the
+ * Makefile).  If memory runs out, it frees what it allocated and
+ * returns NULL with errno set to ENOMEM.
  *
  * @param input  a null-terminated character string
- * @return a pointer to a root structure summarizing the parsing results
+ * @return a pointer to a root structure summarizing the parsing
+ *     results, or NULL
  */
 struct root *parse(char *input);
 
@@ -70,8 +88,8 @@ typedef struct root {
 /**
  * A structure to represent a command in a pipeline.
  *
- * The structure contains five fields: argv, argc, capacity, outfile,
- * and next.
+ * The structure contains nine fields: argv, argc, capacity, outfile,
+ * infile, next, branches, next_branch, and substitutions.
  *
  * The argv field points to an array of pointers to null-terminated
  * strings.  The array is terminated with a NULL pointer.  This array
@@ -83,6 +101,15 @@ typedef struct root {
  * If the command has its output redirected to a file, outfile points
  * to the name of that file (a null-terminated string), else it
  * contains NULL.
+ *
+ * If the output of the command fans out, next is NULL and branches
+ * points to the first command of the first branch.  The first
+ * command of each branch links to the first command of the following
+ * branch through next_branch.
+ *
+ * If some WORDs of the command are substitutions, substitutions points
+ * to the first of them in argv order, else it contains NULL.  The argv
+ * entry of a substitution holds the string "$(".
  */
 typedef struct command {
     char **argv;            ///< pointer to a simple command
@@ -91,4 +118,21 @@ typedef struct command {
     char *outfile;          ///< if non-NULL, out redirect target
     char *infile;           ///< if non-NULL, in redirect target 
     struct command *next;   ///< if non-NULL, next command in pipeline
+    struct command *branches;    ///< if non-NULL, first command of first branch
+    struct command *next_branch; ///< if non-NULL, first command of next branch
+    struct substitution *substitutions; ///< if non-NULL, first substitution
 } command_t;
+
+/**
+ * A structure to represent a command substitution among the WORDs of
+ * a command.
+ *
+ * The index field tells which argv entry the words of the output
+ * replace.  The first_command field points to the first command of
+ * the substituted pipeline, or is NULL if the pipeline is empty.
+ */
+typedef struct substitution {
+    int index;                      ///< index of the replaced argv entry
+    struct command *first_command;  ///< pointer to first command of pipeline
+    struct substitution *next;      ///< if non-NULL, next substitution
+} substitution_t;
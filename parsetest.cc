@@ -1,12 +1,37 @@
 #include <bandit/bandit.h>
 
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
 extern "C" {
+#include "alloc.h"
 #include "parse.h"
 }
 
 using namespace snowhouse;
 using namespace bandit;
 
+static int budget;
+
+static void *failing_acquire(size_t size) {
+    return budget-- > 0 ? malloc(size) : NULL;
+}
+
+static void *failing_resize(void *ptr, size_t size) {
+    return budget-- > 0 ? realloc(ptr, size) : NULL;
+}
+
+/**
+ * A backend failing once budget requests are served.
+ */
+static const alloc_backend_t failing_backend = {
+    "failing", failing_acquire, failing_resize, free
+};
+
 go_bandit([]() {
         describe("parse", []() {
                 it("parsing an empty line", [&]() {
@@ -183,6 +208,115 @@ go_bandit([]() {
                         c = c->next;
                         AssertThat(c, IsNull());
                     });
+                it("parsing a line with a fan-out", [&]() {
+                        char line[] = "one |{ two ; three | four }";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, !Equals(0));
+                        command_t *c = r->first_command;
+                        AssertThat(c, !IsNull());
+                        AssertThat(c->argc, Equals(2));
+                        AssertThat(c->argv[0], Equals("one"));
+                        AssertThat(c->argv[1], IsNull());
+                        AssertThat(c->next, IsNull());
+                        command_t *b = c->branches;
+                        AssertThat(b, !IsNull());
+                        AssertThat(b->argc, Equals(2));
+                        AssertThat(b->argv[0], Equals("two"));
+                        AssertThat(b->argv[1], IsNull());
+                        AssertThat(b->next, IsNull());
+                        b = b->next_branch;
+                        AssertThat(b, !IsNull());
+                        AssertThat(b->argc, Equals(2));
+                        AssertThat(b->argv[0], Equals("three"));
+                        AssertThat(b->argv[1], IsNull());
+                        AssertThat(b->next_branch, IsNull());
+                        c = b->next;
+                        AssertThat(c, !IsNull());
+                        AssertThat(c->argc, Equals(2));
+                        AssertThat(c->argv[0], Equals("four"));
+                        AssertThat(c->argv[1], IsNull());
+                        AssertThat(c->next, IsNull());
+                        parse_end(r);
+                    });
+                it("parsing a line with a nested fan-out", [&]() {
+                        char line[] = "one |{ two |{ three ; four } ; five > out }";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, !Equals(0));
+                        command_t *b = r->first_command->branches;
+                        AssertThat(b->argv[0], Equals("two"));
+                        AssertThat(b->branches, !IsNull());
+                        AssertThat(b->branches->argv[0], Equals("three"));
+                        AssertThat(b->branches->next_branch->argv[0], Equals("four"));
+                        AssertThat(b->branches->next_branch->argc, Equals(2));
+                        b = b->next_branch;
+                        AssertThat(b->argv[0], Equals("five"));
+                        AssertThat(b->argc, Equals(2));
+                        AssertThat(b->outfile, Equals("out"));
+                        AssertThat(b->next_branch, IsNull());
+                        parse_end(r);
+                    });
+                it("parsing separators outside of a fan-out as words", [&]() {
+                        char line[] = "echo ; }";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, !Equals(0));
+                        command_t *c = r->first_command;
+                        AssertThat(c->argc, Equals(4));
+                        AssertThat(c->argv[1], Equals(";"));
+                        AssertThat(c->argv[2], Equals("}"));
+                        parse_end(r);
+                    });
+                it("parsing a line with command substitutions", [&]() {
+                        char line[] = "echo $( ls | grep a ) x $( ) > out";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, !Equals(0));
+                        command_t *c = r->first_command;
+                        AssertThat(c->argc, Equals(5));
+                        AssertThat(c->argv[1], Equals("$("));
+                        AssertThat(c->argv[2], Equals("x"));
+                        AssertThat(c->argv[3], Equals("$("));
+                        AssertThat(c->argv[4], IsNull());
+                        AssertThat(c->outfile, Equals("out"));
+                        AssertThat(c->next, IsNull());
+                        substitution_t *s = c->substitutions;
+                        AssertThat(s, !IsNull());
+                        AssertThat(s->index, Equals(1));
+                        AssertThat(s->first_command->argv[0], Equals("ls"));
+                        AssertThat(s->first_command->argc, Equals(2));
+                        AssertThat(s->first_command->next->argv[1], Equals("a"));
+                        AssertThat(s->first_command->next->argc, Equals(3));
+                        s = s->next;
+                        AssertThat(s->index, Equals(3));
+                        AssertThat(s->first_command, IsNull());
+                        AssertThat(s->next, IsNull());
+                        parse_end(r);
+                    });
+                it("parsing a line with a nested substitution", [&]() {
+                        char line[] = "$( echo $( echo ls ) ) -l | wc";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, !Equals(0));
+                        command_t *c = r->first_command;
+                        AssertThat(c->argv[1], Equals("-l"));
+                        command_t *inner = c->substitutions->first_command;
+                        AssertThat(inner->argv[1], Equals("$("));
+                        AssertThat(inner->substitutions->first_command->argv[1], Equals("ls"));
+                        AssertThat(c->next->argv[0], Equals("wc"));
+                        parse_end(r);
+                    });
+                it("parsing parentheses outside of a substitution as words", [&]() {
+                        char line[] = "echo ) $";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, !Equals(0));
+                        AssertThat(r->first_command->argv[1], Equals(")"));
+                        AssertThat(r->first_command->argv[2], Equals("$"));
+                        AssertThat(r->first_command->substitutions, IsNull());
+                        parse_end(r);
+                    });
             });
 
         describe("parse on malformed input", []() {
@@ -222,5 +356,87 @@ go_bandit([]() {
                         AssertThat(r, !IsNull());
                         AssertThat(r->valid, Equals(0));
                     });
+                it("parsing a line with an unterminated fan-out", [&]() {
+                        char line[] = "one |{ two ; three";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, Equals(0));
+                    });
+                it("parsing a line with an empty fan-out branch", [&]() {
+                        char line[] = "one |{ two ; }";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, Equals(0));
+                    });
+                it("parsing a line with a command after a fan-out", [&]() {
+                        char line[] = "one |{ two } | three";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, Equals(0));
+                    });
+                it("parsing a line with an unterminated substitution", [&]() {
+                        char line[] = "echo $( ls | wc";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, Equals(0));
+                        parse_end(r);
+                    });
+                it("parsing a line with a malformed substitution", [&]() {
+                        char line[] = "echo $( ls | ) x";
+                        root_t *r = parse(line);
+                        AssertThat(r, !IsNull());
+                        AssertThat(r->valid, Equals(0));
+                        parse_end(r);
+                    });
+            });
+
+        describe("parse on failures and concurrently", []() {
+                it("returning NULL when memory runs out", [&]() {
+                        const char *source = "a b c d e | f $( g h ) |{ i j ; k } ";
+                        int failures = 0;
+                        for (int n = 0; ; ++n) {
+                            std::string line = source;
+                            alloc_stats_t before, after;
+                            alloc_get_stats(&before);
+                            budget = n;
+                            alloc_set_backend(&failing_backend);
+                            root_t *r = parse(&line[0]);
+                            int error = errno;
+                            alloc_set_backend(NULL);
+                            if (r != NULL) {
+                                AssertThat(r->valid, !Equals(0));
+                                parse_end(r);
+                                break;
+                            }
+                            AssertThat(error, Equals(ENOMEM));
+                            alloc_get_stats(&after);
+                            AssertThat(after.in_use, Equals(before.in_use));
+                            ++failures;
+                        }
+                        AssertThat(failures > 5, Equals(true));
+                    });
+                it("parsing from many threads at once", [&]() {
+                        int nthreads = std::thread::hardware_concurrency();
+                        if (nthreads < 4) nthreads = 4;
+                        std::atomic<int> errors(0);
+                        std::vector<std::thread> threads;
+                        for (int t = 0; t < nthreads; ++t) {
+                            threads.emplace_back([t, &errors]() {
+                                    for (int i = 0; i < 2000; ++i) {
+                                        std::string w = std::to_string(t) + "." + std::to_string(i);
+                                        std::string line = "cmd " + w + " < in | b $( c " + w + " ) |{ d ; e }";
+                                        root_t *r = parse(&line[0]);
+                                        if (r == NULL || !r->valid
+                                            || w != r->first_command->argv[1]
+                                            || w != r->first_command->next->substitutions->first_command->argv[1]
+                                            || r->first_command->next->branches->next_branch == NULL)
+                                            ++errors;
+                                        parse_end(r);
+                                    }
+                                });
+                        }
+                        for (std::thread &thread : threads) thread.join();
+                        AssertThat(errors.load(), Equals(0));
+                    });
             });
     });
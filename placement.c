@@ -0,0 +1,200 @@
+/**
+ * Support for placing the stages of a pipeline on CPUs.
+ *
+ * A placement is just the ordered list of CPUs to hand out; it is
+ * computed by sorting the allowed CPUs on keys read from the sysfs
+ * topology files.
+ */
+
+#define _GNU_SOURCE
+
+#include "placement.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+
+/**
+ * The topology of one CPU.
+ */
+typedef struct {
+    int cpu;                ///< CPU number
+    long package;           ///< physical package id
+    long llc;               ///< id of the last level cache, or the package
+    long core;              ///< core id within the package
+    int thread;             ///< rank among the SMT siblings of the core
+    int rank;               ///< rank within the cache domain, in compact order
+} cpu_info_t;
+
+/**
+ * This structure represents a placement.
+ */
+typedef struct placement {
+    int *cpus;              ///< CPUs to hand out, in stage order
+    int ncpus;              ///< number of CPUs
+} placement_t;
+
+static int parse_list(const char *s, int *cpus, int max);
+static void read_topology(cpu_info_t *info);
+static long read_number(int cpu, const char *name, long fallback);
+static int compare_compact(const void *a, const void *b);
+static int compare_spread(const void *a, const void *b);
+
+
+struct placement *placement_new(const char *mode) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return NULL;
+
+    placement_t *p = alloc(sizeof(placement_t));
+    p->cpus = alloc(CPU_SETSIZE * sizeof(int));
+    p->ncpus = 0;
+
+    if (strncmp(mode, "cpus=", 5) == 0) {
+        p->ncpus = parse_list(mode + 5, p->cpus, CPU_SETSIZE);
+        for (int i = 0; i < p->ncpus; ++i) {
+            if (!CPU_ISSET(p->cpus[i], &allowed)) p->ncpus = -1;
+        }
+    } else if (strcmp(mode, "compact") == 0 || strcmp(mode, "spread") == 0) {
+        cpu_info_t *infos = alloc(CPU_SETSIZE * sizeof(cpu_info_t));
+        int n = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            infos[n].cpu = cpu;
+            read_topology(&infos[n++]);
+        }
+        qsort(infos, n, sizeof(cpu_info_t), compare_compact);
+        for (int i = 0; i < n; ++i) {
+            int same = i > 0 && infos[i].package == infos[i - 1].package
+                             && infos[i].llc == infos[i - 1].llc;
+            infos[i].rank = same ? infos[i - 1].rank + 1 : 0;
+        }
+        if (mode[0] == 's') qsort(infos, n, sizeof(cpu_info_t), compare_spread);
+        for (int i = 0; i < n; ++i) p->cpus[i] = infos[i].cpu;
+        p->ncpus = n;
+        dealloc(infos);
+    }
+
+    if (p->ncpus <= 0) {
+        placement_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+int placement_cpu(const struct placement *p, int stage) {
+    return p->cpus[stage % p->ncpus];
+}
+
+void placement_apply(const struct placement *p, int stage) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement_cpu(p, stage), &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+void placement_free(struct placement *p) {
+    if (p == NULL) return;
+    dealloc(p->cpus);
+    dealloc(p);
+}
+
+
+/**
+ * Parses a list of CPUs such as 0-3,8 keeping the given order.
+ *
+ * @return the number of CPUs stored in cpus, or -1 if s is malformed
+ *     or names more than max CPUs or a CPU beyond CPU_SETSIZE
+ */
+static int parse_list(const char *s, int *cpus, int max) {
+    int n = 0;
+    for (;;) {
+        char *end;
+        if (*s < '0' || *s > '9') return -1;
+        long first = strtol(s, &end, 10);
+        long last = first;
+        if (*end == '-') {
+            s = end + 1;
+            if (*s < '0' || *s > '9') return -1;
+            last = strtol(s, &end, 10);
+        }
+        if (last < first || last >= CPU_SETSIZE || last - first >= max - n)
+            return -1;
+        for (long cpu = first; cpu <= last; ++cpu) cpus[n++] = cpu;
+        if (*end == '\0') return n;
+        if (*end != ',') return -1;
+        s = end + 1;
+    }
+}
+
+/**
+ * Fills the topology of info->cpu.
+ */
+static void read_topology(cpu_info_t *info) {
+    info->package = read_number(info->cpu, "topology/physical_package_id", 0);
+    info->llc = read_number(info->cpu, "cache/index3/id", -1);
+    info->core = read_number(info->cpu, "topology/core_id", info->cpu);
+    info->thread = 0;
+
+    char path[64];
+    char list[256];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", info->cpu);
+    FILE *f = fopen(path, "re");
+    if (f == NULL) return;
+    if (fgets(list, sizeof(list), f) != NULL) {
+        list[strcspn(list, "\n")] = '\0';
+        int siblings[64];
+        int n = parse_list(list, siblings, 64);
+        for (int i = 0; i < n; ++i) {
+            if (siblings[i] < info->cpu) ++info->thread;
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * Reads a number from a sysfs file of a CPU.
+ */
+static long read_number(int cpu, const char *name, long fallback) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    FILE *f = fopen(path, "re");
+    if (f == NULL) return fallback;
+    long value;
+    if (fscanf(f, "%ld", &value) != 1) value = fallback;
+    fclose(f);
+    return value;
+}
+
+/**
+ * Returns the order of two keys from a qsort() comparison, if they differ.
+ */
+#define COMPARE(x, y) if ((x) != (y)) return (x) < (y) ? -1 : 1
+
+/**
+ * Orders CPUs by package, cache domain, SMT rank and core.
+ */
+static int compare_compact(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    COMPARE(x->package, y->package);
+    COMPARE(x->llc, y->llc);
+    COMPARE(x->thread, y->thread);
+    COMPARE(x->core, y->core);
+    COMPARE(x->cpu, y->cpu);
+    return 0;
+}
+
+/**
+ * Orders CPUs by rank within their cache domain, then package.
+ */
+static int compare_spread(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    COMPARE(x->rank, y->rank);
+    COMPARE(x->package, y->package);
+    COMPARE(x->llc, y->llc);
+    COMPARE(x->cpu, y->cpu);
+    return 0;
+}
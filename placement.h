@@ -0,0 +1,62 @@
+#pragma once
+
+/**
+ * Support for placing the stages of a pipeline on CPUs.  Following
+ * are the placements, named as for the pin prefix of the shell:
+ *
+ *    compact     neighbouring stages on cores sharing the last level
+ *                cache, filling one package before the next
+ *    spread      neighbouring stages on different cache domains,
+ *                cycling over all the domains of all the packages
+ *    cpus=LIST   stage i on the i-th CPU of LIST, e.g. cpus=0-3,8
+ *
+ * Stages are numbered in launch order, and the CPUs are reused
+ * cyclically when there are more stages than CPUs.  Only the CPUs the
+ * shell itself may run on are used; SMT siblings come after all the
+ * cores of their cache domain.
+ *
+ * No memory policy is set: with the default local allocation, a
+ * pinned stage allocates its buffers on the node of its CPU.
+ */
+
+struct placement; // forward declaration
+
+/**
+ * Computes a placement from its name.
+ *
+ * The topology is read from /sys/devices/system/cpu; when it cannot
+ * be read, every CPU is taken as its own core in a single package.
+ *
+ * @param mode  compact, spread or cpus=LIST
+ * @return a placement to free with placement_free(), or NULL if mode
+ *     is malformed or names a CPU the shell may not run on
+ */
+struct placement *placement_new(const char *mode);
+
+/**
+ * Tells which CPU a stage goes to.
+ *
+ * @param p  placement
+ * @param stage  index of the stage, from 0
+ * @return the CPU number
+ */
+int placement_cpu(const struct placement *p, int stage);
+
+/**
+ * Binds the calling process to the CPU of a stage.
+ *
+ * This function only makes a system call, so it is safe to use
+ * between fork() and exec() in a multithreaded process.  Failures are
+ * ignored: the stage then runs wherever the scheduler puts it.
+ *
+ * @param p  placement
+ * @param stage  index of the stage, from 0
+ */
+void placement_apply(const struct placement *p, int stage);
+
+/**
+ * Frees a placement.
+ *
+ * @param p  placement returned by placement_new(), or NULL
+ */
+void placement_free(struct placement *p);
@@ -0,0 +1,61 @@
+#include <bandit/bandit.h>
+
+#include <set>
+
+extern "C" {
+#include <sched.h>
+#include "placement.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Returns the lowest CPU this process may run on.
+ */
+static int first_allowed_cpu() {
+    cpu_set_t set;
+    sched_getaffinity(0, sizeof(set), &set);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &set)) ++cpu;
+    return cpu;
+}
+
+go_bandit([]() {
+        describe("placement_new", []() {
+                it("parsing an explicit list", [&]() {
+                        int cpu = first_allowed_cpu();
+                        std::string mode = "cpus=" + std::to_string(cpu) + "," + std::to_string(cpu);
+                        struct placement *p = placement_new(mode.c_str());
+                        AssertThat(p, !IsNull());
+                        AssertThat(placement_cpu(p, 0), Equals(cpu));
+                        AssertThat(placement_cpu(p, 5), Equals(cpu));
+                        placement_free(p);
+                    });
+                it("covering every allowed CPU once", [&]() {
+                        cpu_set_t set;
+                        sched_getaffinity(0, sizeof(set), &set);
+                        for (const char *mode : { "compact", "spread" }) {
+                            struct placement *p = placement_new(mode);
+                            AssertThat(p, !IsNull());
+                            std::set<int> seen;
+                            for (int i = 0; i < CPU_COUNT(&set); ++i) {
+                                int cpu = placement_cpu(p, i);
+                                AssertThat(CPU_ISSET(cpu, &set), !Equals(0));
+                                seen.insert(cpu);
+                            }
+                            AssertThat((int) seen.size(), Equals(CPU_COUNT(&set)));
+                            AssertThat(placement_cpu(p, CPU_COUNT(&set)), Equals(placement_cpu(p, 0)));
+                            placement_free(p);
+                        }
+                    });
+                it("rejecting malformed placements", [&]() {
+                        AssertThat(placement_new("tight"), IsNull());
+                        AssertThat(placement_new("cpus="), IsNull());
+                        AssertThat(placement_new("cpus=3-1"), IsNull());
+                        AssertThat(placement_new("cpus=0,"), IsNull());
+                        AssertThat(placement_new("cpus=1x"), IsNull());
+                        AssertThat(placement_new("cpus=99999"), IsNull());
+                    });
+            });
+    });
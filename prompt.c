@@ -0,0 +1,324 @@
+/**
+ * Support for a configurable prompt.
+ *
+ * The main thread posts the directory of each render to the
+ * background thread, which walks up to the .git directory, stats its
+ * HEAD file and only reads it when the entry cached for the directory
+ * is missing or older.  A newer pending directory replaces an older
+ * one, so the thread never lags behind.
+ */
+
+#define _GNU_SOURCE
+
+#include "prompt.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "error.h"
+#include "thread.h"
+
+/**
+ * The number of directories whose git branch is cached.
+ */
+#define CACHE_SIZE 16
+
+/**
+ * The longest branch name shown.
+ */
+#define BRANCH_MAX 256
+
+/**
+ * The git branch of a directory.
+ */
+typedef struct {
+    char *dir;                  ///< directory, or NULL if the entry is unused
+    struct timespec mtime;      ///< modification time of HEAD when read
+    char branch[BRANCH_MAX];    ///< branch, empty outside of a repository
+    unsigned long used;         ///< time of last use, for eviction
+} entry_t;
+
+/**
+ * This structure buffers the rendered prompt.
+ */
+typedef struct {
+    char *data;                 ///< rendered characters
+    size_t length;              ///< number of characters
+    size_t size;                ///< room in data
+} buffer_t;
+
+static const char *format = PROMPT_DEFAULT;
+static int last_status;
+static uint64_t last_duration;
+
+// Shared with the background thread.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static int started;             ///< non-zero if the thread runs
+static char *request;           ///< directory to look up, or NULL
+static int changed;             ///< non-zero if a result changed
+static entry_t cache[CACHE_SIZE];
+static unsigned long clock_tick;
+
+static void *run(void *arg);
+static void look_up(const char *dir);
+static int find_head(const char *dir, char *head, size_t size);
+static void read_branch(const char *head, char *branch);
+static entry_t *find_entry(const char *dir);
+static void append(buffer_t *b, const char *s, size_t length);
+static void append_duration(buffer_t *b, uint64_t us);
+static void append_branch(buffer_t *b, const char *dir);
+
+
+void prompt_init(const char *f) {
+    format = f != NULL ? f : PROMPT_DEFAULT;
+    if (started || strstr(format, "%g") == NULL) return;
+
+    pthread_t thread;
+    int rc = start_thread(&thread, run, NULL);
+    if (rc != 0) {
+        err_with_errnum("prompt", rc);
+        return;
+    }
+    pthread_detach(thread);
+    started = 1;
+}
+
+void prompt_update(int status, uint64_t duration_us) {
+    last_status = status;
+    last_duration = duration_us;
+}
+
+char *prompt_render(void) {
+    buffer_t b = { alloc(64), 0, 64 };
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) strcpy(cwd, "?");
+
+    for (const char *f = format; *f; ++f) {
+        if (f[0] != '%' || f[1] == '\0') {
+            append(&b, f, 1);
+            continue;
+        }
+        char number[16];
+        const char *home;
+        size_t n;
+        switch (*++f) {
+        case 'd':
+            home = getenv("HOME");
+            n = home != NULL ? strlen(home) : 0;
+            if (n > 1 && strncmp(cwd, home, n) == 0 && (cwd[n] == '/' || cwd[n] == '\0')) {
+                append(&b, "~", 1);
+                append(&b, cwd + n, strlen(cwd + n));
+            } else {
+                append(&b, cwd, strlen(cwd));
+            }
+            break;
+        case 's':
+            append(&b, number, snprintf(number, sizeof(number), "%d", last_status));
+            break;
+        case 't':
+            append_duration(&b, last_duration);
+            break;
+        case 'g':
+            append_branch(&b, cwd);
+            break;
+        default:
+            append(&b, f, 1);
+            break;
+        }
+    }
+    append(&b, "", 1);
+    return b.data;
+}
+
+int prompt_changed(void) {
+    if (!started) return 0;
+    pthread_mutex_lock(&lock);
+    int c = changed;
+    changed = 0;
+    pthread_mutex_unlock(&lock);
+    return c;
+}
+
+
+/**
+ * The body of the background thread.
+ */
+static void *run(void *arg) {
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (request == NULL) pthread_cond_wait(&wake, &lock);
+        char *dir = request;
+        request = NULL;
+        pthread_mutex_unlock(&lock);
+
+        look_up(dir);
+        dealloc(dir);
+    }
+    return NULL;
+}
+
+/**
+ * Finds the git branch of a directory, updating the cache.
+ */
+static void look_up(const char *dir) {
+    char head[PATH_MAX];
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    int found = find_head(dir, head, sizeof(head)) && stat(head, &st) == 0;
+
+    pthread_mutex_lock(&lock);
+    entry_t *e = find_entry(dir);
+    int fresh = e != NULL && e->mtime.tv_sec == st.st_mtim.tv_sec
+                && e->mtime.tv_nsec == st.st_mtim.tv_nsec;
+    pthread_mutex_unlock(&lock);
+    if (fresh) return;
+
+    char branch[BRANCH_MAX] = "";
+    if (found) read_branch(head, branch);
+
+    pthread_mutex_lock(&lock);
+    e = find_entry(dir);
+    if (e == NULL) {
+        // Take an unused entry, else the least recently used one.
+        e = &cache[0];
+        for (int i = 1; i < CACHE_SIZE && e->dir != NULL; ++i) {
+            if (cache[i].dir == NULL || cache[i].used < e->used) e = &cache[i];
+        }
+        dealloc(e->dir);
+        e->dir = alloc(strlen(dir) + 1);
+        strcpy(e->dir, dir);
+        e->branch[0] = '\0';
+        e->used = ++clock_tick;
+    }
+    e->mtime = st.st_mtim;
+    if (strcmp(e->branch, branch) != 0) {
+        strcpy(e->branch, branch);
+        changed = 1;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Finds the HEAD file of the repository holding a directory, following
+ * the "gitdir:" files of worktrees and submodules.
+ *
+ * @return non-zero if found
+ */
+static int find_head(const char *dir, char *head, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (;;) {
+        size_t n = strlen(path);
+        struct stat st;
+        if ((size_t) snprintf(head, size, "%s%s.git", path,
+                              n > 0 && path[n - 1] == '/' ? "" : "/") >= size)
+            return 0;
+        if (stat(head, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                strncat(head, "/HEAD", size - strlen(head) - 1);
+                return 1;
+            }
+            FILE *f = fopen(head, "re");
+            char line[PATH_MAX];
+            int ok = f != NULL && fgets(line, sizeof(line), f) != NULL
+                     && strncmp(line, "gitdir: ", 8) == 0;
+            if (f != NULL) fclose(f);
+            if (!ok) return 0;
+            line[strcspn(line, "\n")] = '\0';
+            int length = line[8] == '/' ? snprintf(head, size, "%s/HEAD", line + 8)
+                       : snprintf(head, size, "%s/%s/HEAD", path, line + 8);
+            return (size_t) length < size;
+        }
+        // Go up one directory.
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || n <= 1) return 0;
+        if (slash == path) slash[1] = '\0';
+        else               slash[0] = '\0';
+    }
+}
+
+/**
+ * Reads the branch named by a HEAD file.
+ */
+static void read_branch(const char *head, char *branch) {
+    FILE *f = fopen(head, "re");
+    if (f == NULL) return;
+    char line[BRANCH_MAX + 32];
+    if (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        const char *ref = "ref: refs/heads/";
+        if (strncmp(line, ref, strlen(ref)) == 0) {
+            snprintf(branch, BRANCH_MAX, "%.*s", BRANCH_MAX - 1, line + strlen(ref));
+        } else {
+            snprintf(branch, BRANCH_MAX, "%.7s", line);
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * Returns the cache entry of a directory, or NULL.  The lock must be
+ * held.
+ */
+static entry_t *find_entry(const char *dir) {
+    for (int i = 0; i < CACHE_SIZE; ++i) {
+        if (cache[i].dir != NULL && strcmp(cache[i].dir, dir) == 0) {
+            cache[i].used = ++clock_tick;
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Appends characters to the rendered prompt.
+ */
+static void append(buffer_t *b, const char *s, size_t length) {
+    if (b->length + length > b->size) {
+        while (b->length + length > b->size) b->size *= 2;
+        b->data = realloc_array(b->data, b->size, 1);
+    }
+    memcpy(b->data + b->length, s, length);
+    b->length += length;
+}
+
+/**
+ * Appends a duration with a unit suited to its magnitude.
+ */
+static void append_duration(buffer_t *b, uint64_t us) {
+    char s[32];
+    unsigned long long v = us;
+    int n;
+    if (v < 1000)            n = snprintf(s, sizeof(s), "%lluus", v);
+    else if (v < 1000000)    n = snprintf(s, sizeof(s), "%llums", v / 1000);
+    else if (v < 60000000)   n = snprintf(s, sizeof(s), "%.1fs", v / 1e6);
+    else                     n = snprintf(s, sizeof(s), "%llum%llus", v / 60000000,
+                                          v / 1000000 % 60);
+    append(b, s, n);
+}
+
+/**
+ * Appends the cached git branch of a directory, and asks the background
+ * thread to look it up again.
+ */
+static void append_branch(buffer_t *b, const char *dir) {
+    if (!started) return;
+    char *copy = alloc(strlen(dir) + 1);
+    strcpy(copy, dir);
+
+    pthread_mutex_lock(&lock);
+    entry_t *e = find_entry(dir);
+    if (e != NULL) append(b, e->branch, strlen(e->branch));
+    dealloc(request);
+    request = copy;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
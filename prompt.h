@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Support for a configurable prompt.  The format of the prompt is
+ * taken literally, except for the following segments:
+ *
+ *    %d    current directory, with the home directory shown as ~
+ *    %s    exit status of the last line
+ *    %t    duration of the last line
+ *    %g    git branch, or short commit id on a detached HEAD; empty
+ *          outside of a repository or until known
+ *    %%    a percent sign
+ *
+ * The git branch is found by a background thread, so rendering the
+ * prompt never waits on the file system.  Results are cached per
+ * directory and revalidated against the modification time of the
+ * HEAD file each time the prompt is rendered; prompt_changed() tells
+ * when a result should be shown in place of what was rendered.
+ */
+
+/**
+ * The prompt used when no format is given.
+ */
+#define PROMPT_DEFAULT "> "
+
+/**
+ * Sets the format of the prompt, starting the background thread if a
+ * segment needs it.
+ *
+ * @param format  format of the prompt, or NULL for PROMPT_DEFAULT;
+ *     it must stay valid
+ */
+void prompt_init(const char *format);
+
+/**
+ * Records the outcome of the last line, for the %s and %t segments.
+ *
+ * @param status  exit status
+ * @param duration_us  wall time, in microseconds
+ */
+void prompt_update(int status, uint64_t duration_us);
+
+/**
+ * Renders the prompt with the values known so far.
+ *
+ * On unrecoverable errors this function calls die_with_message().
+ *
+ * @return the prompt, to free with dealloc()
+ */
+char *prompt_render(void);
+
+/**
+ * Tells whether a background segment changed since the last render.
+ *
+ * @return non-zero if the prompt should be rendered again
+ */
+int prompt_changed(void);
@@ -0,0 +1,98 @@
+#include <bandit/bandit.h>
+
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "prompt.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Returns the prompt rendered with the current values.
+ */
+static std::string render() {
+    char *p = prompt_render();
+    std::string s = p;
+    dealloc(p);
+    return s;
+}
+
+/**
+ * Renders the prompt until it shows a changed background segment, for
+ * at most two seconds.
+ */
+static std::string render_changed() {
+    render();
+    for (int i = 0; i < 200 && !prompt_changed(); ++i) usleep(10000);
+    return render();
+}
+
+/**
+ * Writes a HEAD file in a new .git directory.
+ */
+static void write_head(const std::string &dir, const char *content) {
+    mkdir((dir + "/.git").c_str(), 0700);
+    FILE *f = fopen((dir + "/.git/HEAD").c_str(), "w");
+    fputs(content, f);
+    fclose(f);
+}
+
+go_bandit([]() {
+        describe("prompt_render", []() {
+                it("rendering the default prompt", [&]() {
+                        prompt_init(NULL);
+                        AssertThat(render(), Equals(PROMPT_DEFAULT));
+                    });
+                it("rendering the status and the duration", [&]() {
+                        prompt_init("[%s %t] 100%% ");
+                        prompt_update(3, 250);
+                        AssertThat(render(), Equals("[3 250us] 100% "));
+                        prompt_update(0, 1500000);
+                        AssertThat(render(), Equals("[0 1.5s] 100% "));
+                        prompt_update(0, 125000000);
+                        AssertThat(render(), Equals("[0 2m5s] 100% "));
+                    });
+                it("rendering the current directory", [&]() {
+                        char cwd[4096];
+                        AssertThat(getcwd(cwd, sizeof(cwd)), !IsNull());
+                        prompt_init("%d$ ");
+                        AssertThat(render(), Equals(std::string(cwd) + "$ "));
+                    });
+            });
+
+        describe("git branch", []() {
+                it("showing the branch once found in the background", [&]() {
+                        char cwd[4096];
+                        AssertThat(getcwd(cwd, sizeof(cwd)), !IsNull());
+                        char dir[] = "/tmp/prompttestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        std::string top = dir;
+                        write_head(top, "ref: refs/heads/feature\n");
+                        mkdir((top + "/sub").c_str(), 0700);
+                        AssertThat(chdir((top + "/sub").c_str()), Equals(0));
+
+                        prompt_init("(%g) ");
+                        AssertThat(render_changed(), Equals("(feature) "));
+
+                        // A detached HEAD shows a short commit id.
+                        struct timespec times[2] = { { 0, UTIME_NOW }, { 1, 0 } };
+                        write_head(top, "0123456789abcdef0123456789abcdef01234567\n");
+                        utimensat(AT_FDCWD, (top + "/.git/HEAD").c_str(), times, 0);
+                        AssertThat(render_changed(), Equals("(0123456) "));
+
+                        // Outside of a repository, the segment is empty.
+                        AssertThat(chdir(cwd), Equals(0));
+                        std::string s = render_changed();
+                        if (system(("rm -rf " + top).c_str()) != 0) {}
+                        AssertThat(s.find("0123456"), Equals(std::string::npos));
+                    });
+            });
+    });
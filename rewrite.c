@@ -0,0 +1,145 @@
+/**
+ * The rewrite pass over parsed pipelines.
+ *
+ * Each pipeline is walked through a pointer to the link holding the
+ * current command, so that a command can be unlinked in place.
+ */
+
+#include "rewrite.h"
+
+#include <string.h>
+
+#include "alloc.h"
+#include "parse.h"
+
+static int rewrite_pipeline(struct command **link, int piped);
+static int is_plain_cat(const struct command *c);
+static int is_file(const char *word);
+static void drop(struct command **link);
+static void print_commands(FILE *out, const struct command *c);
+
+
+int rewrite(struct root *r) {
+    return rewrite_pipeline(&r->first_command, 0);
+}
+
+void print_pipeline(FILE *out, const struct command *first_command) {
+    print_commands(out, first_command);
+    fputc('\n', out);
+}
+
+
+/**
+ * Rewrites the pipeline starting at *link.
+ *
+ * @param link  where the first command of the pipeline is linked
+ * @param piped  non-zero if the pipeline reads from a pipe
+ * @return the number of processes removed
+ */
+static int rewrite_pipeline(struct command **link, int piped) {
+    int removed = 0;
+
+    // cat FILE | COMMAND, or cat < FILE | COMMAND
+    struct command *c;
+    while ((c = *link) != NULL && is_plain_cat(c) && c->next != NULL
+           && c->next->infile == NULL && c->outfile == NULL
+           && (c->argv[1] != NULL) != (c->infile != NULL)) {
+        c->next->infile = c->infile != NULL ? c->infile : c->argv[1];
+        drop(link);
+        ++removed;
+    }
+
+    struct command *prev = NULL;
+    while ((c = *link) != NULL) {
+        for (struct substitution *s = c->substitutions; s != NULL; s = s->next) {
+            removed += rewrite_pipeline(&s->first_command, 0);
+        }
+        for (struct command **b = &c->branches; *b != NULL; b = &(*b)->next_branch) {
+            removed += rewrite_pipeline(b, 1);
+        }
+
+        int middle = prev != NULL || piped;
+        if (middle && is_plain_cat(c) && c->argv[1] == NULL && c->infile == NULL) {
+            // COMMAND | cat > FILE
+            if (c->next == NULL && c->outfile != NULL && prev != NULL
+                && prev->outfile == NULL && prev->branches == NULL) {
+                prev->outfile = c->outfile;
+                drop(link);
+                ++removed;
+                continue;
+            }
+            // COMMAND | cat | ...
+            if (c->next != NULL && c->outfile == NULL) {
+                drop(link);
+                ++removed;
+                continue;
+            }
+        }
+        prev = c;
+        link = &c->next;
+    }
+    return removed;
+}
+
+/**
+ * Tells whether a command is cat with at most one file and no
+ * fan-out or substitution.
+ */
+static int is_plain_cat(const struct command *c) {
+    if (strcmp(c->argv[0], "cat") != 0) return 0;
+    if (c->branches != NULL || c->substitutions != NULL) return 0;
+    return c->argv[1] == NULL || (is_file(c->argv[1]) && c->argv[2] == NULL);
+}
+
+/**
+ * Tells whether a word is certainly a file name.
+ */
+static int is_file(const char *word) {
+    return word[0] != '-' && word[0] != '$';
+}
+
+/**
+ * Unlinks the command at *link and frees it.
+ */
+static void drop(struct command **link) {
+    struct command *c = *link;
+    *link = c->next;
+    // The first command of a branch links to the next branch.
+    if (c->next != NULL) c->next->next_branch = c->next_branch;
+    // Plain cats own nothing else.
+    dealloc(c->argv);
+    dealloc(c);
+}
+
+/**
+ * Prints commands from c on, without a newline.
+ */
+static void print_commands(FILE *out, const struct command *c) {
+    for (; c != NULL; c = c->next) {
+        const struct substitution *s = c->substitutions;
+        for (int i = 0; c->argv[i] != NULL; ++i) {
+            if (i > 0) fputc(' ', out);
+            if (s != NULL && s->index == i) {
+                fputs("$( ", out);
+                if (s->first_command != NULL) {
+                    print_commands(out, s->first_command);
+                    fputc(' ', out);
+                }
+                fputc(')', out);
+                s = s->next;
+            } else {
+                fputs(c->argv[i], out);
+            }
+        }
+        if (c->infile != NULL) fprintf(out, " < %s", c->infile);
+        if (c->outfile != NULL) fprintf(out, " > %s", c->outfile);
+        if (c->branches != NULL) {
+            fputs(" |{ ", out);
+            for (const struct command *b = c->branches; b != NULL; b = b->next_branch) {
+                print_commands(out, b);
+                fputs(b->next_branch != NULL ? " ; " : " }", out);
+            }
+        }
+        if (c->next != NULL) fputs(" | ", out);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * A rewrite pass over parsed pipelines (see parse.h) that removes
+ * cat processes doing nothing but copying data.  Following are the
+ * rewrites:
+ *
+ *    cat FILE | COMMAND ...       becomes   COMMAND < FILE ...
+ *    cat < FILE | COMMAND ...     becomes   COMMAND < FILE ...
+ *    ... COMMAND | cat > FILE     becomes   ... COMMAND > FILE
+ *    ... COMMAND | cat | ...      becomes   ... COMMAND | ...
+ *
+ * provided that the commands involved have no conflicting
+ * redirection.  A cat reading the standard input first in a pipeline
+ * or writing the standard output last is kept, since the command next
+ * to it would see a terminal instead of a pipe.  FILE must not look
+ * like an option or a variable reference.
+ *
+ * The pass applies to fan-out branches and substitutions as well.
+ */
+
+struct root; // forward declaration
+struct command; // forward declaration
+
+/**
+ * Rewrites a valid pipeline in place, freeing the removed commands.
+ *
+ * @param r  pointer to a root structure returned by parse()
+ * @return the number of processes removed
+ */
+int rewrite(struct root *r);
+
+/**
+ * Prints a pipeline in the syntax accepted by parse(), followed by a
+ * newline.
+ *
+ * @param out  where to print
+ * @param first_command  first command of the pipeline, or NULL
+ */
+void print_pipeline(FILE *out, const struct command *first_command);
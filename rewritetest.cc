@@ -0,0 +1,81 @@
+#include <bandit/bandit.h>
+
+#include <string>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include "parse.h"
+#include "rewrite.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Parses and rewrites a line, returning the printed result and setting
+ * removed to the number of processes removed.
+ */
+static std::string rewritten(const char *line, int *removed) {
+    std::string input(line);
+    root_t *r = parse(&input[0]);
+    AssertThat(r->valid, !Equals(0));
+    *removed = rewrite(r);
+    char *data;
+    size_t length;
+    FILE *out = open_memstream(&data, &length);
+    print_pipeline(out, r->first_command);
+    fclose(out);
+    std::string s(data, length);
+    free(data);
+    parse_end(r);
+    return s;
+}
+
+go_bandit([]() {
+        describe("rewrite", []() {
+                it("turning a leading cat into a redirection", [&]() {
+                        int n;
+                        AssertThat(rewritten("cat in | wc -l", &n), Equals("wc -l < in\n"));
+                        AssertThat(n, Equals(1));
+                        AssertThat(rewritten("cat < in | sort | uniq", &n), Equals("sort < in | uniq\n"));
+                        AssertThat(n, Equals(1));
+                    });
+                it("turning a trailing cat into a redirection", [&]() {
+                        int n;
+                        AssertThat(rewritten("ls | cat > out", &n), Equals("ls > out\n"));
+                        AssertThat(n, Equals(1));
+                    });
+                it("dropping cats in the middle", [&]() {
+                        int n;
+                        AssertThat(rewritten("cat in | cat | cat | grep x | cat > out", &n),
+                                   Equals("grep x < in > out\n"));
+                        AssertThat(n, Equals(4));
+                    });
+                it("rewriting branches and substitutions", [&]() {
+                        int n;
+                        AssertThat(rewritten("echo $( cat f | wc ) |{ cat | sort ; cat }", &n),
+                                   Equals("echo $( wc < f ) |{ sort ; cat }\n"));
+                        AssertThat(n, Equals(2));
+                    });
+                it("keeping the cats that matter", [&]() {
+                        const char *kept[] = {
+                            "cat | wc",                     // terminal input
+                            "ls | cat",                     // terminal output
+                            "cat a b | wc",                 // concatenation
+                            "cat -n f | wc",                // option
+                            "cat $f | wc",                  // variable
+                            "cat f | wc < g",               // conflicting input
+                            "ls > a | cat > b",             // conflicting output
+                            "cat f > g | wc",               // output elsewhere
+                            "cat f",                        // single command
+                            "ls | cat < f | wc",            // input elsewhere
+                        };
+                        for (const char *line : kept) {
+                            int n;
+                            AssertThat(rewritten(line, &n), Equals(std::string(line) + "\n"));
+                            AssertThat(n, Equals(0));
+                        }
+                    });
+            });
+    });
@@ -0,0 +1,144 @@
+/**
+ * Support for single-producer, single-consumer byte rings.
+ *
+ * The head and tail indices count bytes since the creation of the
+ * ring and are reduced modulo the capacity on access only, so that a
+ * full ring (head - tail == capacity) and an empty one (head == tail)
+ * are told apart without wasting a slot.  They live on separate cache
+ * lines to keep the two threads from invalidating each other's line
+ * on every update.
+ */
+
+#define _GNU_SOURCE
+
+#include "ring.h"
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc.h"
+
+#define CACHE_LINE 64
+
+/**
+ * This structure represents a ring.
+ */
+typedef struct ring {
+    char *data;                 ///< storage, capacity bytes
+    size_t mask;                ///< capacity - 1
+    int writer_closed;          ///< set once by the producer
+    int reader_closed;          ///< set once by the consumer
+    int refs;                   ///< number of sides still open
+    char pad1[CACHE_LINE];
+    size_t head;                ///< bytes written, owned by the producer
+    char pad2[CACHE_LINE - sizeof(size_t)];
+    size_t tail;                ///< bytes read, owned by the consumer
+    char pad3[CACHE_LINE - sizeof(size_t)];
+} ring_t;
+
+static void backoff(int *rounds);
+static void release(ring_t *r);
+
+ring_t *ring_new(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size *= 2;
+
+    ring_t *r = alloc(sizeof(ring_t));
+    r->data = alloc(size);
+    r->mask = size - 1;
+    r->writer_closed = 0;
+    r->reader_closed = 0;
+    r->refs = 2;
+    r->head = 0;
+    r->tail = 0;
+    return r;
+}
+
+size_t ring_write(ring_t *r, const char *data, size_t length) {
+    size_t done = 0;
+    int rounds = 0;
+
+    while (done < length) {
+        if (__atomic_load_n(&r->reader_closed, __ATOMIC_ACQUIRE)) break;
+        size_t head = r->head;
+        size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        size_t room = r->mask + 1 - (head - tail);
+        if (room == 0) {
+            backoff(&rounds);
+            continue;
+        }
+        rounds = 0;
+
+        size_t n = length - done < room ? length - done : room;
+        size_t at = head & r->mask;
+        size_t first = n < r->mask + 1 - at ? n : r->mask + 1 - at;
+        memcpy(r->data + at, data + done, first);
+        memcpy(r->data, data + done + first, n - first);
+        __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+        done += n;
+    }
+    return done;
+}
+
+size_t ring_read(ring_t *r, char *data, size_t length) {
+    int rounds = 0;
+
+    for (;;) {
+        // Check for closing first: bytes written before the close are
+        // then visible below.
+        int closed = __atomic_load_n(&r->writer_closed, __ATOMIC_ACQUIRE);
+        size_t tail = r->tail;
+        size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        size_t available = head - tail;
+        if (available == 0) {
+            if (closed) return 0;
+            backoff(&rounds);
+            continue;
+        }
+
+        size_t n = length < available ? length : available;
+        size_t at = tail & r->mask;
+        size_t first = n < r->mask + 1 - at ? n : r->mask + 1 - at;
+        memcpy(data, r->data + at, first);
+        memcpy(data + first, r->data, n - first);
+        __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+        return n;
+    }
+}
+
+void ring_close_writer(ring_t *r) {
+    __atomic_store_n(&r->writer_closed, 1, __ATOMIC_RELEASE);
+    release(r);
+}
+
+void ring_close_reader(ring_t *r) {
+    __atomic_store_n(&r->reader_closed, 1, __ATOMIC_RELEASE);
+    release(r);
+}
+
+/**
+ * Waits a little before retrying, longer as the rounds go by.
+ */
+static void backoff(int *rounds) {
+    ++*rounds;
+    if (*rounds <= 64) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);    // cheap busy wait
+    } else if (*rounds <= 128) {
+        sched_yield();
+    } else {
+        int shift = *rounds - 128 < 10 ? *rounds - 128 : 10;
+        struct timespec ts = { 0, 1000L << shift };  // 1 us up to 1 ms
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * Drops one reference, freeing the ring with the last one.
+ */
+static void release(ring_t *r) {
+    if (__atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        dealloc(r->data);
+        dealloc(r);
+    }
+}
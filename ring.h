@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * A single-producer, single-consumer byte ring joining two threads.
+ *
+ * The producer only writes the head index and the consumer only the
+ * tail index, each published with release/acquire atomics, so neither
+ * side ever takes a lock.  A side that can make no progress spins
+ * briefly, then yields, then sleeps for increasing periods.
+ *
+ * Either side may close the ring: after the producer closes it, the
+ * consumer reads the remaining bytes then end-of-file; after the
+ * consumer closes it, the producer's writes fail.  The ring is freed
+ * once both sides have closed it.
+ */
+
+struct ring; // forward declaration
+
+/**
+ * Creates a ring.
+ *
+ * On unrecoverable errors this function calls die_with_message().
+ *
+ * @param capacity  size of the ring in bytes, rounded up to a power of two
+ * @return a pointer to the ring
+ */
+struct ring *ring_new(size_t capacity);
+
+/**
+ * Writes all of data to the ring, waiting for room as needed.
+ *
+ * Only the producer may call this function.
+ *
+ * @param r  pointer to the ring
+ * @param data  bytes to write
+ * @param length  number of bytes to write
+ * @return length, or less if the consumer closed the ring
+ */
+size_t ring_write(struct ring *r, const char *data, size_t length);
+
+/**
+ * Reads at most length bytes, waiting until at least one is available.
+ *
+ * Only the consumer may call this function.
+ *
+ * @param r  pointer to the ring
+ * @param data  where to store the bytes
+ * @param length  maximum number of bytes to read
+ * @return the number of bytes read, 0 on end-of-file
+ */
+size_t ring_read(struct ring *r, char *data, size_t length);
+
+/**
+ * Closes the producer side of the ring.
+ *
+ * @param r  pointer to the ring
+ */
+void ring_close_writer(struct ring *r);
+
+/**
+ * Closes the consumer side of the ring.
+ *
+ * @param r  pointer to the ring
+ */
+void ring_close_reader(struct ring *r);
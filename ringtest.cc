@@ -0,0 +1,52 @@
+#include <bandit/bandit.h>
+
+#include <string>
+#include <thread>
+
+extern "C" {
+#include "ring.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+go_bandit([]() {
+        describe("ring", []() {
+                it("reading what was written", [&]() {
+                        struct ring *r = ring_new(16);
+                        AssertThat(ring_write(r, "hello", 5), Equals(5u));
+                        char data[16];
+                        AssertThat(ring_read(r, data, sizeof(data)), Equals(5u));
+                        AssertThat(std::string(data, 5), Equals("hello"));
+                        ring_close_writer(r);
+                        AssertThat(ring_read(r, data, sizeof(data)), Equals(0u));
+                        ring_close_reader(r);
+                    });
+                it("streaming through a small ring", [&]() {
+                        struct ring *r = ring_new(64);
+                        std::string sent;
+                        for (int i = 0; i < 20000; ++i) sent += std::to_string(i) + "\n";
+                        std::thread producer([&]() {
+                                for (size_t i = 0; i < sent.size(); i += 100) {
+                                    size_t n = sent.size() - i < 100 ? sent.size() - i : 100;
+                                    ring_write(r, sent.data() + i, n);
+                                }
+                                ring_close_writer(r);
+                            });
+                        std::string received;
+                        char data[37];
+                        size_t n;
+                        while ((n = ring_read(r, data, sizeof(data))) > 0)
+                            received.append(data, n);
+                        ring_close_reader(r);
+                        producer.join();
+                        AssertThat(received == sent, Equals(true));
+                    });
+                it("failing writes once the reader is gone", [&]() {
+                        struct ring *r = ring_new(8);
+                        ring_close_reader(r);
+                        AssertThat(ring_write(r, "0123456789", 10), Equals(0u));
+                        ring_close_writer(r);
+                    });
+            });
+    });
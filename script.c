@@ -0,0 +1,464 @@
+/*
+ * This compiler recognizes compound commands with the same recursive
+ * descent technique as the pipeline parser (see parse.c), over this
+ * LL(1) grammar:
+ *
+ * list -> item list'
+ * list' -> ';' item list'
+ * list' -> ε
+ * item -> ε
+ * item -> 'for' NAME 'in' words ';' 'do' list 'done'
+ * item -> 'while' list 'do' list 'done'
+ * item -> 'if' list 'then' list if' 'fi'
+ * item -> pipeline
+ * if' -> 'elif' list 'then' list if'
+ * if' -> 'else' list
+ * if' -> ε
+ * words -> WORD words
+ * words -> ε
+ *
+ * Keywords are only recognized at the start of an item, so that they
+ * can be used freely as arguments of commands.  A pipeline extends up
+ * to the next ';' token outside of a fan-out and is handed as is to
+ * parse().
+ *
+ * Instead of building a tree, the compiler emits instructions for a
+ * small stack-less machine as it goes.  Forward jumps are emitted
+ * with a dummy target and patched once the target is known.  For
+ * instance, "while C ; do B ; done" becomes:
+ *
+ *    top:  C
+ *          JUMP_UNLESS end
+ *          B
+ *          JUMP top
+ *    end:
+ */
+
+#include "script.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "error.h"
+#include "parse.h"
+#include "rewrite.h"
+
+/**
+ * This structure represents a word of the source.
+ *
+ * Unlike the tokens of the pipeline parser, words are not
+ * null-terminated as they are found since they may belong to a
+ * pipeline handed later to parse().
+ */
+typedef struct {
+    char *begin;            ///< beginning of word, NULL on end-of-file
+    size_t length;          ///< number of characters in word
+} word_t;
+
+/**
+ * This structure represents the state of the compiler.
+ */
+typedef struct {
+    char *input;            ///< pointer to the remaining source
+    word_t prev_word;       ///< putback word if has_prev is non-zero
+    int has_prev;           ///< non-zero if a word was putback
+    program_t *prog;        ///< program being compiled
+} compiler_t;
+
+// Forward declaration of local functions.
+compile_status_t compile_list(compiler_t *c);
+compile_status_t compile_for(compiler_t *c);
+compile_status_t compile_while(compiler_t *c);
+compile_status_t compile_if(compiler_t *c);
+compile_status_t compile_pipeline(compiler_t *c, word_t first);
+compile_status_t compile_end_of_item(compiler_t *c);
+compile_status_t expect_keyword(compiler_t *c, const char *keyword);
+word_t get_word(compiler_t *c);
+void putback_word(compiler_t *c, word_t w);
+void terminate_word(word_t w);
+int is_word(word_t w, const char *s);
+int is_terminator(word_t w);
+int is_name(const char *s, size_t length);
+int emit(program_t *prog, opcode_t op, int a, int b);
+int add_template(program_t *prog);
+void add_slots(program_t *prog, int t, struct command *cmd);
+void add_slot(program_t *prog, int t, char **where);
+int find_variable(program_t *prog, char *name);
+int add_loop(program_t *prog, int var);
+void add_word_to_loop(program_t *prog, int l, char *word);
+void *grow(void *array, int count, int *capacity, size_t size);
+
+
+int starts_compound(const char *line) {
+    while (*line && isspace((unsigned char) *line)) ++line;
+    size_t length = 0;
+    while (line[length] && !isspace((unsigned char) line[length])) ++length;
+    word_t w = { (char *) line, length };
+    return is_word(w, "for") || is_word(w, "while") || is_word(w, "if");
+}
+
+program_t *compile(const char *source) {
+    compiler_t compiler;
+    program_t *prog = alloc(sizeof(program_t));
+
+    memset(prog, 0, sizeof(program_t));
+    prog->source = alloc(strlen(source) + 1);
+    strcpy(prog->source, source);
+
+    compiler.input = prog->source;
+    compiler.has_prev = 0;
+    compiler.prog = prog;
+
+    prog->status = compile_list(&compiler);
+    if (prog->status == COMPILE_OK && get_word(&compiler).begin != NULL)
+        prog->status = COMPILE_ERROR;   // stray keyword such as 'done'
+
+    return prog;
+}
+
+int interpret(program_t *prog, pipeline_runner_t run, void *ctx) {
+    static char empty[] = "";
+    int status = 0;
+    int pc = 0;
+
+    assert(prog->status == COMPILE_OK);
+
+    for (int i = 0; i < prog->nvars; ++i) {
+        char *value = getenv(prog->vars[i].name);
+        prog->vars[i].value = value != NULL ? value : empty;
+    }
+
+    while (pc < prog->ncode) {
+        instruction_t *in = &prog->code[pc++];
+        switch (in->op) {
+        case OP_RUN: {
+            template_t *t = &prog->templates[in->a];
+            for (int i = 0; i < t->nslots; ++i)
+                *t->slots[i].where = prog->vars[t->slots[i].var].value;
+            status = run(t->root->first_command, ctx);
+            break;
+        }
+        case OP_JUMP:
+            pc = in->a;
+            break;
+        case OP_JUMP_UNLESS:
+            if (status != 0) pc = in->a;
+            break;
+        case OP_FOR_INIT:
+            prog->loops[in->a].next = 0;
+            break;
+        case OP_FOR_NEXT: {
+            loop_t *l = &prog->loops[in->a];
+            if (l->next < l->nwords)
+                prog->vars[l->var].value = l->words[l->next++];
+            else
+                pc = in->b;
+            break;
+        }
+        }
+    }
+
+    return status;
+}
+
+void compile_end(program_t *prog) {
+    if (prog == NULL) return;
+    for (int i = 0; i < prog->ntemplates; ++i) {
+        parse_end(prog->templates[i].root);
+        dealloc(prog->templates[i].slots);
+    }
+    for (int i = 0; i < prog->nloops; ++i)
+        dealloc(prog->loops[i].words);
+    dealloc(prog->templates);
+    dealloc(prog->loops);
+    dealloc(prog->vars);
+    dealloc(prog->code);
+    dealloc(prog->source);
+    dealloc(prog);
+}
+
+
+compile_status_t compile_list(compiler_t *c) {
+    for (;;) {
+        word_t w = get_word(c);
+        compile_status_t s;
+
+        if (w.begin == NULL || is_terminator(w)) {
+            putback_word(c, w);
+            return COMPILE_OK;
+        }
+        if (is_word(w, ";"))
+            continue;   // empty item
+
+        if (is_word(w, "for"))        s = compile_for(c);
+        else if (is_word(w, "while")) s = compile_while(c);
+        else if (is_word(w, "if"))    s = compile_if(c);
+        else                          s = compile_pipeline(c, w);
+        if (s != COMPILE_OK) return s;
+    }
+}
+
+compile_status_t compile_for(compiler_t *c) {
+    compile_status_t s;
+    word_t w = get_word(c);
+
+    if (w.begin == NULL) return COMPILE_INCOMPLETE;
+    if (!is_name(w.begin, w.length)) return COMPILE_ERROR;
+    terminate_word(w);
+    int l = add_loop(c->prog, find_variable(c->prog, w.begin));
+
+    if ((s = expect_keyword(c, "in")) != COMPILE_OK) return s;
+    for (;;) {
+        w = get_word(c);
+        if (w.begin == NULL) return COMPILE_INCOMPLETE;
+        if (is_word(w, ";")) break;
+        // The words are fixed at compile time, so neither substitutions
+        // nor variable references can be expanded here.
+        if (is_word(w, "$(") || (w.begin[0] == '$' && is_name(w.begin + 1, w.length - 1)))
+            return COMPILE_ERROR;
+        terminate_word(w);
+        add_word_to_loop(c->prog, l, w.begin);
+    }
+
+    if ((s = expect_keyword(c, "do")) != COMPILE_OK) return s;
+    emit(c->prog, OP_FOR_INIT, l, 0);
+    int top = emit(c->prog, OP_FOR_NEXT, l, -1);
+    if ((s = compile_list(c)) != COMPILE_OK) return s;
+    if ((s = expect_keyword(c, "done")) != COMPILE_OK) return s;
+    emit(c->prog, OP_JUMP, top, 0);
+    c->prog->code[top].b = c->prog->ncode;
+
+    return compile_end_of_item(c);
+}
+
+compile_status_t compile_while(compiler_t *c) {
+    compile_status_t s;
+    int top = c->prog->ncode;
+
+    if ((s = compile_list(c)) != COMPILE_OK) return s;
+    if ((s = expect_keyword(c, "do")) != COMPILE_OK) return s;
+    int skip = emit(c->prog, OP_JUMP_UNLESS, -1, 0);
+    if ((s = compile_list(c)) != COMPILE_OK) return s;
+    if ((s = expect_keyword(c, "done")) != COMPILE_OK) return s;
+    emit(c->prog, OP_JUMP, top, 0);
+    c->prog->code[skip].a = c->prog->ncode;
+
+    return compile_end_of_item(c);
+}
+
+compile_status_t compile_if(compiler_t *c) {
+    compile_status_t s;
+    int skip;       // jump over the current branch when its test fails
+    int ends = -1;  // chain of jumps to the end, linked through operand a
+
+    for (;;) {
+        if ((s = compile_list(c)) != COMPILE_OK) return s;
+        if ((s = expect_keyword(c, "then")) != COMPILE_OK) return s;
+        skip = emit(c->prog, OP_JUMP_UNLESS, -1, 0);
+        if ((s = compile_list(c)) != COMPILE_OK) return s;
+
+        word_t w = get_word(c);
+        if (w.begin == NULL) return COMPILE_INCOMPLETE;
+        if (is_word(w, "fi")) {
+            c->prog->code[skip].a = c->prog->ncode;
+            break;
+        }
+        if (!is_word(w, "elif") && !is_word(w, "else")) return COMPILE_ERROR;
+        ends = emit(c->prog, OP_JUMP, ends, 0);
+        c->prog->code[skip].a = c->prog->ncode;
+        if (is_word(w, "else")) {
+            if ((s = compile_list(c)) != COMPILE_OK) return s;
+            if ((s = expect_keyword(c, "fi")) != COMPILE_OK) return s;
+            break;
+        }
+    }
+
+    while (ends != -1) {
+        int next = c->prog->code[ends].a;
+        c->prog->code[ends].a = c->prog->ncode;
+        ends = next;
+    }
+
+    return compile_end_of_item(c);
+}
+
+compile_status_t compile_pipeline(compiler_t *c, word_t first) {
+    word_t w;
+
+    // Find the end of the pipeline before parse() alters the source.
+    // Within a fan-out, ';' separates branches instead.
+    int depth = 0;
+    for (;;) {
+        w = get_word(c);
+        if (w.begin == NULL || (depth == 0 && is_word(w, ";"))) break;
+        if (is_word(w, "|{")) ++depth;
+        else if (depth > 0 && is_word(w, "}")) --depth;
+    }
+    if (w.begin != NULL) *w.begin = '\0';
+
+    int t = add_template(c->prog);
+    struct root *r = parse(first.begin);
+    if (r == NULL) die_with_errno(NULL);
+    c->prog->templates[t].root = r;
+    if (!r->valid) return COMPILE_ERROR;
+    rewrite(r);
+    add_slots(c->prog, t, r->first_command);
+    emit(c->prog, OP_RUN, t, 0);
+
+    return COMPILE_OK;
+}
+
+compile_status_t compile_end_of_item(compiler_t *c) {
+    word_t w = get_word(c);
+    if (w.begin == NULL) {
+        putback_word(c, w);
+        return COMPILE_OK;
+    }
+    return is_word(w, ";") ? COMPILE_OK : COMPILE_ERROR;
+}
+
+compile_status_t expect_keyword(compiler_t *c, const char *keyword) {
+    word_t w = get_word(c);
+    if (w.begin == NULL) return COMPILE_INCOMPLETE;
+    return is_word(w, keyword) ? COMPILE_OK : COMPILE_ERROR;
+}
+
+word_t get_word(compiler_t *c) {
+    word_t w;
+
+    // Check for a recently putback word.
+    if (c->has_prev) {
+        c->has_prev = 0;
+        return c->prev_word;
+    }
+
+    // Skip whitespace.
+    while (*c->input && isspace((unsigned char) *c->input)) ++c->input;
+
+    // Check for EOF.
+    if (!*c->input) {
+        w.begin = NULL;
+        w.length = 0;
+        return w;
+    }
+
+    // Find a word.  Step over the whitespace following it so that
+    // terminate_word() may later overwrite that whitespace.
+    w.begin = c->input;
+    while (*c->input && !isspace((unsigned char) *c->input)) ++c->input;
+    w.length = c->input - w.begin;
+    if (*c->input) ++c->input;
+
+    return w;
+}
+
+void putback_word(compiler_t *c, word_t w) {
+    assert(!c->has_prev);
+    c->prev_word = w;
+    c->has_prev = 1;
+}
+
+void terminate_word(word_t w) {
+    w.begin[w.length] = '\0';
+}
+
+int is_word(word_t w, const char *s) {
+    return w.begin != NULL && w.length == strlen(s)
+        && strncmp(w.begin, s, w.length) == 0;
+}
+
+int is_terminator(word_t w) {
+    return is_word(w, "do") || is_word(w, "done") || is_word(w, "then")
+        || is_word(w, "elif") || is_word(w, "else") || is_word(w, "fi");
+}
+
+int is_name(const char *s, size_t length) {
+    if (length == 0 || !(isalpha((unsigned char) s[0]) || s[0] == '_'))
+        return 0;
+    for (size_t i = 1; i < length; ++i)
+        if (!(isalnum((unsigned char) s[i]) || s[i] == '_')) return 0;
+    return 1;
+}
+
+int emit(program_t *prog, opcode_t op, int a, int b) {
+    prog->code = grow(prog->code, prog->ncode, &prog->code_capacity,
+                      sizeof(instruction_t));
+    prog->code[prog->ncode].op = op;
+    prog->code[prog->ncode].a = a;
+    prog->code[prog->ncode].b = b;
+    return prog->ncode++;
+}
+
+int add_template(program_t *prog) {
+    prog->templates = grow(prog->templates, prog->ntemplates,
+                           &prog->templates_capacity, sizeof(template_t));
+    template_t *t = &prog->templates[prog->ntemplates];
+    t->root = NULL;
+    t->slots = NULL;
+    t->nslots = 0;
+    t->capacity = 0;
+    return prog->ntemplates++;
+}
+
+void add_slots(program_t *prog, int t, struct command *cmd) {
+    for (; cmd != NULL; cmd = cmd->next) {
+        for (int i = 0; cmd->argv[i] != NULL; ++i)
+            add_slot(prog, t, &cmd->argv[i]);
+        if (cmd->infile != NULL) add_slot(prog, t, &cmd->infile);
+        if (cmd->outfile != NULL) add_slot(prog, t, &cmd->outfile);
+        for (struct command *b = cmd->branches; b != NULL; b = b->next_branch)
+            add_slots(prog, t, b);
+        for (struct substitution *s = cmd->substitutions; s != NULL; s = s->next)
+            add_slots(prog, t, s->first_command);
+    }
+}
+
+void add_slot(program_t *prog, int t, char **where) {
+    char *s = *where;
+    if (s[0] != '$' || !is_name(s + 1, strlen(s + 1))) return;
+
+    template_t *tp = &prog->templates[t];
+    tp->slots = grow(tp->slots, tp->nslots, &tp->capacity, sizeof(slot_t));
+    tp->slots[tp->nslots].where = where;
+    tp->slots[tp->nslots].var = find_variable(prog, s + 1);
+    ++tp->nslots;
+}
+
+int find_variable(program_t *prog, char *name) {
+    for (int i = 0; i < prog->nvars; ++i)
+        if (strcmp(prog->vars[i].name, name) == 0) return i;
+    prog->vars = grow(prog->vars, prog->nvars, &prog->vars_capacity,
+                      sizeof(variable_t));
+    prog->vars[prog->nvars].name = name;
+    prog->vars[prog->nvars].value = NULL;
+    return prog->nvars++;
+}
+
+int add_loop(program_t *prog, int var) {
+    prog->loops = grow(prog->loops, prog->nloops, &prog->loops_capacity,
+                       sizeof(loop_t));
+    loop_t *l = &prog->loops[prog->nloops];
+    l->var = var;
+    l->words = NULL;
+    l->nwords = 0;
+    l->capacity = 0;
+    l->next = 0;
+    return prog->nloops++;
+}
+
+void add_word_to_loop(program_t *prog, int l, char *word) {
+    loop_t *lp = &prog->loops[l];
+    lp->words = grow(lp->words, lp->nwords, &lp->capacity, sizeof(char *));
+    lp->words[lp->nwords++] = word;
+}
+
+void *grow(void *array, int count, int *capacity, size_t size) {
+    assert(count <= *capacity);
+    if (count < *capacity) return array;
+    *capacity = *capacity == 0 ? 4 : 2 * *capacity;
+    return realloc_array(array, *capacity, size);
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+/**
+ * This is a compiler and interpreter for compound commands, i.e., the
+ * for, while and if blocks found in traditional shells.  Following
+ * are the supported forms, where LIST is a sequence of pipelines (see
+ * parse.h) or nested compound commands separated by ';' tokens:
+ *
+ *    for NAME in [ WORD ] ... ; do LIST ; done
+ *    while LIST ; do LIST ; done
+ *    if LIST ; then LIST [ ; elif LIST ; then LIST ] ... [ ; else LIST ] ; fi
+ *
+ * As for pipelines, each token must be separated by whitespaces.  A
+ * WORD of a pipeline made of '$' followed by a NAME is a variable
+ * reference; it is replaced by the current value of the variable each
+ * time the pipeline runs.  Variables are bound by for loops; names
+ * not bound by any loop take their value from the environment, or
+ * the empty string if unset.  The WORDs of a for loop are taken
+ * literally: a WORD that is a variable reference or starts a command
+ * substitution, e.g. "for i in $x" or "for i in $( seq 3 )", is a
+ * syntax error.
+ *
+ * A compound command is compiled once into a program: an array of
+ * instructions and a set of pipeline templates, each template being
+ * the output of parse() plus a list of slots to patch with variable
+ * values.  Running a program never tokenizes nor allocates memory,
+ * so a loop costs little more than the commands it runs.
+ */
+
+struct command; // forward declaration
+struct program; // forward declaration
+
+/**
+ * A function that runs a pipeline and returns its exit status.
+ *
+ * @param first_command  the first command of the pipeline
+ * @param ctx  the pointer given to interpret()
+ * @return the exit status of the pipeline
+ */
+typedef int (*pipeline_runner_t)(struct command *first_command, void *ctx);
+
+/**
+ * The different outcomes of a compilation.
+ */
+typedef enum {
+    COMPILE_OK,          ///< the source is a complete compound command
+    COMPILE_INCOMPLETE,  ///< the source is valid so far but a block is open
+    COMPILE_ERROR,       ///< the source is malformed
+} compile_status_t;
+
+/**
+ * Tells whether a line starts a compound command.
+ *
+ * @param line  a null-terminated character string
+ * @return non-zero if the first token of line is for, while or if
+ */
+int starts_compound(const char *line);
+
+/**
+ * Compiles a compound command into a program.
+ *
+ * Unlike parse(), this function does not modify source; it works on
+ * its own copy.  The caller must check the status field of the
+ * returned program and is responsible for freeing it by calling
+ * compile_end(), whatever the status.
+ *
+ * On unrecoverable errors this function calls die_with_errno(NULL).
+ *
+ * @param source  a null-terminated character string
+ * @return a pointer to the compiled program
+ */
+struct program *compile(const char *source);
+
+/**
+ * Runs a program compiled with status COMPILE_OK.
+ *
+ * Each pipeline of the program is handed, with its variables
+ * substituted, to run.  The pipeline must not be modified by run.
+ *
+ * @param prog  pointer to a program
+ * @param run  function launching a pipeline
+ * @param ctx  opaque pointer passed along to run
+ * @return the exit status of the last pipeline run, or 0 if none ran
+ */
+int interpret(struct program *prog, pipeline_runner_t run, void *ctx);
+
+/**
+ * Free all the structures allocated by a call to compile().
+ *
+ * @param prog  pointer to a program
+ */
+void compile_end(struct program *prog);
+
+/**
+ * The operations of the intermediate form.
+ */
+typedef enum {
+    OP_RUN,         ///< run template a, setting the status
+    OP_JUMP,        ///< continue at instruction a
+    OP_JUMP_UNLESS, ///< continue at instruction a if status is non-zero
+    OP_FOR_INIT,    ///< rewind loop a to its first word
+    OP_FOR_NEXT,    ///< bind the next word of loop a, else jump to b
+} opcode_t;
+
+/**
+ * One instruction of a program.
+ */
+typedef struct {
+    opcode_t op;    ///< operation
+    int a;          ///< first operand
+    int b;          ///< second operand
+} instruction_t;
+
+/**
+ * A place in a pipeline template that receives the value of a variable.
+ */
+typedef struct {
+    char **where;   ///< pointer to the argv entry or file name to patch
+    int var;        ///< index of the variable
+} slot_t;
+
+/**
+ * A pipeline compiled once and run many times.
+ */
+typedef struct {
+    struct root *root;  ///< parse() output for the pipeline
+    slot_t *slots;      ///< places to patch before each run
+    int nslots;         ///< number of slots
+    int capacity;       ///< number of slots that can fit in slots
+} template_t;
+
+/**
+ * A variable referenced by a program.
+ */
+typedef struct {
+    char *name;     ///< name of the variable, without the '$'
+    char *value;    ///< current value
+} variable_t;
+
+/**
+ * The state of a for loop.
+ */
+typedef struct {
+    int var;        ///< index of the loop variable
+    char **words;   ///< words to iterate over
+    int nwords;     ///< number of words
+    int capacity;   ///< number of words that can fit in words
+    int next;       ///< index of the next word to bind
+} loop_t;
+
+/**
+ * A compiled compound command.
+ *
+ * The status field tells the outcome of the compilation.  All other
+ * fields are for internal use only; do not access them.
+ */
+typedef struct program {
+    compile_status_t status;    ///< outcome of the compilation
+    char *source;               ///< private copy of the source
+    instruction_t *code;        ///< instructions
+    int ncode;                  ///< number of instructions
+    int code_capacity;          ///< number of instructions that can fit
+    template_t *templates;      ///< pipeline templates
+    int ntemplates;             ///< number of templates
+    int templates_capacity;     ///< number of templates that can fit
+    variable_t *vars;           ///< variables
+    int nvars;                  ///< number of variables
+    int vars_capacity;          ///< number of variables that can fit
+    loop_t *loops;              ///< for loops
+    int nloops;                 ///< number of loops
+    int loops_capacity;         ///< number of loops that can fit
+} program_t;
@@ -0,0 +1,168 @@
+#include <bandit/bandit.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "parse.h"
+#include "script.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Records each pipeline run as a string, commands separated by " | ".
+ * The exit status is 1 for a pipeline starting with "false", else 0.
+ */
+static int record(struct command *c, void *ctx) {
+    std::vector<std::string> *runs = (std::vector<std::string> *) ctx;
+    std::string s;
+    int status = c != NULL && std::string(c->argv[0]) == "false";
+    for (; c != NULL; c = c->next) {
+        for (int i = 0; c->argv[i] != NULL; ++i) {
+            if (i > 0) s += " ";
+            s += c->argv[i];
+        }
+        if (c->outfile != NULL) s += std::string(" > ") + c->outfile;
+        if (c->next != NULL) s += " | ";
+    }
+    runs->push_back(s);
+    return status;
+}
+
+go_bandit([]() {
+        describe("starts_compound", []() {
+                it("recognizing compound commands", [&]() {
+                        AssertThat(starts_compound("for i in a ; do x ; done"), !Equals(0));
+                        AssertThat(starts_compound("  while true"), !Equals(0));
+                        AssertThat(starts_compound("if"), !Equals(0));
+                        AssertThat(starts_compound("echo for"), Equals(0));
+                        AssertThat(starts_compound("format"), Equals(0));
+                        AssertThat(starts_compound(""), Equals(0));
+                    });
+            });
+
+        describe("compile", []() {
+                it("compiling a for loop", [&]() {
+                        program_t *p = compile("for i in a b c ; do echo $i > $i ; done");
+                        AssertThat(p, !IsNull());
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        int status = interpret(p, record, &runs);
+                        AssertThat(status, Equals(0));
+                        AssertThat(runs.size(), Equals(3u));
+                        AssertThat(runs[0], Equals("echo a > a"));
+                        AssertThat(runs[1], Equals("echo b > b"));
+                        AssertThat(runs[2], Equals("echo c > c"));
+                        compile_end(p);
+                    });
+                it("running a program twice", [&]() {
+                        program_t *p = compile("for i in a b ; do echo $i | wc ; done");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(4u));
+                        AssertThat(runs[1], Equals("echo b | wc"));
+                        AssertThat(runs[2], Equals("echo a | wc"));
+                        compile_end(p);
+                    });
+                it("compiling nested loops", [&]() {
+                        program_t *p = compile("for i in a b ; do for j in 1 2 ; do echo $i $j ; done ; done");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(4u));
+                        AssertThat(runs[0], Equals("echo a 1"));
+                        AssertThat(runs[3], Equals("echo b 2"));
+                        compile_end(p);
+                    });
+                it("compiling a while loop", [&]() {
+                        program_t *p = compile("while false ; do echo never ; done ; echo after");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(2u));
+                        AssertThat(runs[0], Equals("false"));
+                        AssertThat(runs[1], Equals("echo after"));
+                        compile_end(p);
+                    });
+                it("compiling an if with elif and else", [&]() {
+                        program_t *p = compile("if false ; then echo 1 ; elif true ; then echo 2 ; else echo 3 ; fi");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(3u));
+                        AssertThat(runs[2], Equals("echo 2"));
+                        compile_end(p);
+                    });
+                it("compiling an if taking the else branch", [&]() {
+                        program_t *p = compile("if false ; then echo 1 ; else echo 3 ; fi");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(2u));
+                        AssertThat(runs[1], Equals("echo 3"));
+                        compile_end(p);
+                    });
+                it("compiling a fan-out inside a loop", [&]() {
+                        program_t *p = compile("for i in a ; do echo $i |{ cat ; wc $i } ; done");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(1u));
+                        AssertThat(runs[0], Equals("echo a"));
+                        command_t *b = p->templates[0].root->first_command->branches;
+                        AssertThat(b->argv[0], Equals("cat"));
+                        AssertThat(b->next_branch->argv[1], Equals("a"));
+                        compile_end(p);
+                    });
+                it("using keywords as arguments", [&]() {
+                        program_t *p = compile("if true ; then echo done fi ; fi");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        std::vector<std::string> runs;
+                        interpret(p, record, &runs);
+                        AssertThat(runs.size(), Equals(2u));
+                        AssertThat(runs[1], Equals("echo done fi"));
+                        compile_end(p);
+                    });
+            });
+
+        describe("compile on partial or malformed input", []() {
+                it("compiling an unterminated loop", [&]() {
+                        program_t *p = compile("for i in a b ; do echo $i");
+                        AssertThat(p->status, Equals(COMPILE_INCOMPLETE));
+                        compile_end(p);
+                        p = compile("while true");
+                        AssertThat(p->status, Equals(COMPILE_INCOMPLETE));
+                        compile_end(p);
+                    });
+                it("compiling a stray keyword", [&]() {
+                        program_t *p = compile("echo a ; done");
+                        AssertThat(p->status, Equals(COMPILE_ERROR));
+                        compile_end(p);
+                    });
+                it("compiling a malformed pipeline", [&]() {
+                        program_t *p = compile("for i in a ; do echo | ; done");
+                        AssertThat(p->status, Equals(COMPILE_ERROR));
+                        compile_end(p);
+                    });
+                it("compiling a loop with a bad variable name", [&]() {
+                        program_t *p = compile("for 1x in a ; do echo ; done");
+                        AssertThat(p->status, Equals(COMPILE_ERROR));
+                        compile_end(p);
+                    });
+                it("compiling a loop over words it cannot expand", [&]() {
+                        program_t *p = compile("for i in $( seq 1 3 ) ; do echo $i ; done");
+                        AssertThat(p->status, Equals(COMPILE_ERROR));
+                        compile_end(p);
+                        p = compile("for y in a $x ; do echo $y ; done");
+                        AssertThat(p->status, Equals(COMPILE_ERROR));
+                        compile_end(p);
+                        p = compile("for y in $ a$x ; do echo $y ; done");
+                        AssertThat(p->status, Equals(COMPILE_OK));
+                        compile_end(p);
+                    });
+            });
+    });
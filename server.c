@@ -0,0 +1,209 @@
+/**
+ * Support for running the shell as a command server.
+ */
+
+#define _GNU_SOURCE
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error.h"
+
+static int listen_on(const char *path);
+static int is_stale(const char *path, const struct sockaddr_un *addr);
+static void work(int conn, line_runner_t run);
+static int receive(int conn, char *text, size_t size, int fds[3]);
+static long elapsed_us(const struct timespec *start);
+static long cpu_us(const struct timeval *tv);
+
+int serve(const char *path, line_runner_t run) {
+    int sock = listen_on(path);
+    if (sock < 0) return 1;
+
+    // Workers are reaped automatically; they restore the default
+    // action to wait for their own children.
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            err_with_errno("accept");
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            err_with_errno("fork");
+        } else if (pid == 0) {
+            close(sock);
+            signal(SIGCHLD, SIG_DFL);
+            work(conn, run);
+            _exit(0);
+        }
+        close(conn);
+    }
+}
+
+/**
+ * Creates the listening socket, replacing a stale one.
+ *
+ * @return the socket, or -1 on errors
+ */
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        err_with_errnum(path, ENAMETOOLONG);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        err_with_errno("socket");
+        return -1;
+    }
+    int rc = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    if (rc < 0 && errno == EADDRINUSE && is_stale(path, &addr)) {
+        rc = unlink(path);
+        if (rc == 0) rc = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    }
+    if (rc < 0) {
+        err_with_errno(path);
+        close(sock);
+        return -1;
+    }
+    if (listen(sock, SOMAXCONN) < 0) {
+        err_with_errno("listen");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * Tells whether path is a socket nobody answers on, left by a server
+ * that is gone.  Files of other types are never deemed stale.
+ *
+ * This function preserves errno.
+ */
+static int is_stale(const char *path, const struct sockaddr_un *addr) {
+    int err = errno;
+    struct stat st;
+    int stale = 0;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0) {
+            stale = connect(probe, (const struct sockaddr *) addr, sizeof(*addr)) < 0
+                && errno == ECONNREFUSED;
+            close(probe);
+        }
+    }
+    errno = err;
+    return stale;
+}
+
+/**
+ * Serves the requests of one connection until the client leaves.
+ */
+static void work(int conn, line_runner_t run) {
+    static char text[SERVER_MAX_REQUEST + 1];
+    int fds[3];
+
+    while (receive(conn, text, sizeof(text), fds)) {
+        struct timespec start;
+        struct rusage self0, children0, self1, children1;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        getrusage(RUSAGE_SELF, &self0);
+        getrusage(RUSAGE_CHILDREN, &children0);
+
+        // Run with the client's standard streams.
+        for (int i = 0; i < 3; ++i) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        int status = run(text);
+        fflush(stdout);
+        fflush(stderr);
+
+        getrusage(RUSAGE_SELF, &self1);
+        getrusage(RUSAGE_CHILDREN, &children1);
+        char reply[128];
+        int n = snprintf(reply, sizeof(reply),
+                         "status %d wall_us %ld user_us %ld sys_us %ld\n",
+                         status, elapsed_us(&start),
+                         cpu_us(&self1.ru_utime) - cpu_us(&self0.ru_utime)
+                         + cpu_us(&children1.ru_utime) - cpu_us(&children0.ru_utime),
+                         cpu_us(&self1.ru_stime) - cpu_us(&self0.ru_stime)
+                         + cpu_us(&children1.ru_stime) - cpu_us(&children0.ru_stime));
+        if (send(conn, reply, n, MSG_NOSIGNAL) < 0) break;
+    }
+}
+
+/**
+ * Receives a request.
+ *
+ * @return non-zero if a well-formed request was received
+ */
+static int receive(int conn, char *text, size_t size, int fds[3]) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct iovec iov = { text, size - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    while ((n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0) return 0;
+    text[n] = '\0';
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c == NULL || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS
+        || c->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        err_with_message("server: request without file descriptors");
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(c), 3 * sizeof(int));
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        err_with_message("server: request too long");
+        for (int i = 0; i < 3; ++i) close(fds[i]);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Returns the microseconds elapsed since start.
+ */
+static long elapsed_us(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L
+        + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/**
+ * Converts a CPU time to microseconds.
+ */
+static long cpu_us(const struct timeval *tv) {
+    return tv->tv_sec * 1000000L + tv->tv_usec;
+}
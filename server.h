@@ -0,0 +1,47 @@
+#pragma once
+
+/**
+ * Support for running the shell as a command server.
+ *
+ * The server listens on a Unix domain socket of type SOCK_SEQPACKET.
+ * Each connection is served by a forked worker, so that clients run
+ * concurrently, and may carry any number of requests in turn:
+ *
+ *  - a request is one message holding the text of a command line, up
+ *    to SERVER_MAX_REQUEST bytes, with three file descriptors attached
+ *    as SCM_RIGHTS ancillary data: the standard input, output and
+ *    error to run the command line with;
+ *
+ *  - the reply is one message holding a line of text:
+ *
+ *       status N wall_us W user_us U sys_us S
+ *
+ *    where N is the exit status of the command line, W the elapsed
+ *    time and U and S the CPU times spent by the shell and the
+ *    commands, all in microseconds.
+ */
+
+/**
+ * The maximum size of a request.
+ */
+#define SERVER_MAX_REQUEST 65536
+
+/**
+ * A function that runs a line of input and returns its exit status.
+ *
+ * @param line  a null-terminated character string it may modify
+ * @return the exit status
+ */
+typedef int (*line_runner_t)(char *line);
+
+/**
+ * Serves requests forever.
+ *
+ * A stale socket left at path by a server that is gone is replaced.
+ * This function only returns on errors, after printing a message.
+ *
+ * @param path  path of the socket
+ * @param run  function running each request
+ * @return 1
+ */
+int serve(const char *path, line_runner_t run);
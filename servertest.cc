@@ -0,0 +1,166 @@
+#include <bandit/bandit.h>
+
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "server.h"
+}
+
+using namespace snowhouse;
+using namespace bandit;
+
+/**
+ * Runs a request by echoing it, with a recognizable status.
+ */
+static int echo(char *line) {
+    if (write(STDOUT_FILENO, line, strlen(line)) < 0) return 1;
+    return 42;
+}
+
+/**
+ * Runs a server in a child process, with its errors discarded.  The
+ * server is killed after a while, should a test fail to stop it.
+ */
+static pid_t start_server(const std::string &path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDERR_FILENO);
+        alarm(10);
+        _exit(serve(path.c_str(), echo));
+    }
+    return pid;
+}
+
+/**
+ * Connects to a server, waiting for it to listen.
+ */
+static int connect_to(const std::string &path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    for (int i = 0; i < 500; ++i) {
+        int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0) return sock;
+        close(sock);
+        usleep(2000);
+    }
+    return -1;
+}
+
+/**
+ * Sends a request with the given standard output, returning the reply.
+ */
+static std::string request(int sock, const char *text, int out) {
+    int null = open("/dev/null", O_RDWR);
+    int fds[3] = { null, out, null };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov = { (void *) text, strlen(text) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    AssertThat(sendmsg(sock, &msg, 0), Equals((ssize_t) strlen(text)));
+    close(null);
+
+    char reply[128];
+    ssize_t n = recv(sock, reply, sizeof(reply), 0);
+    return std::string(reply, n > 0 ? n : 0);
+}
+
+/**
+ * Runs a request through a server, checking its output and status.
+ */
+static void check_round_trip(const std::string &path) {
+    int sock = connect_to(path);
+    AssertThat(sock, !Equals(-1));
+    int p[2];
+    AssertThat(pipe(p), Equals(0));
+    std::string reply = request(sock, "hello", p[1]);
+    close(p[1]);
+    AssertThat(reply.compare(0, 10, "status 42 "), Equals(0));
+    char out[16];
+    ssize_t n = read(p[0], out, sizeof(out));
+    AssertThat(std::string(out, n > 0 ? n : 0), Equals("hello"));
+    close(p[0]);
+    close(sock);
+}
+
+/**
+ * Stops a server started by start_server().
+ */
+static void stop_server(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+go_bandit([]() {
+        describe("serve", []() {
+                it("running requests with the streams of the client", [&]() {
+                        char dir[] = "/tmp/servertestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        std::string path = std::string(dir) + "/sock";
+                        pid_t pid = start_server(path);
+                        check_round_trip(path);
+                        stop_server(pid);
+                        unlink(path.c_str());
+                        rmdir(dir);
+                    });
+                it("replacing a stale socket", [&]() {
+                        char dir[] = "/tmp/servertestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        std::string path = std::string(dir) + "/sock";
+                        struct sockaddr_un addr;
+                        memset(&addr, 0, sizeof(addr));
+                        addr.sun_family = AF_UNIX;
+                        strcpy(addr.sun_path, path.c_str());
+                        int stale = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+                        AssertThat(bind(stale, (struct sockaddr *) &addr, sizeof(addr)), Equals(0));
+                        close(stale);
+                        pid_t pid = start_server(path);
+                        check_round_trip(path);
+                        stop_server(pid);
+                        unlink(path.c_str());
+                        rmdir(dir);
+                    });
+                it("leaving other files in place", [&]() {
+                        char dir[] = "/tmp/servertestXXXXXX";
+                        AssertThat(mkdtemp(dir), !IsNull());
+                        std::string path = std::string(dir) + "/precious.txt";
+                        FILE *f = fopen(path.c_str(), "w");
+                        fputs("precious\n", f);
+                        fclose(f);
+                        int status;
+                        waitpid(start_server(path), &status, 0);
+                        AssertThat(WIFEXITED(status) && WEXITSTATUS(status) == 1, Equals(true));
+                        char content[16] = "";
+                        f = fopen(path.c_str(), "r");
+                        AssertThat(f, !IsNull());
+                        AssertThat(fgets(content, sizeof(content), f), !IsNull());
+                        fclose(f);
+                        AssertThat(std::string(content), Equals("precious\n"));
+                        unlink(path.c_str());
+                        rmdir(dir);
+                    });
+            });
+    });
@@ -2,134 +2,888 @@
 Author: Nicholas Dill
 This is a shell which implents some of the basic features of the BASH shell, namely command piping and output redirection.
 */
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdio.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 
+#include "alloc.h"
+#include "bench.h"
+#include "cache.h"
+#include "capture.h"
+#include "error.h"
+#include "fanout.h"
+#include "filter.h"
+#include "metrics.h"
 #include "parse.h"
+#include "placement.h"
+#include "prompt.h"
+#include "rewrite.h"
+#include "ring.h"
+#include "script.h"
+#include "server.h"
+#include "zygote.h"
+
+/**
+ * The size of the rings joining adjacent built-in filters.
+ */
+#define RING_SIZE 65536
+
+/**
+ * The arguments of a command after substitution.  They are kept until
+ * the pipeline ends, built-in filters referring to them as they run.
+ */
+typedef struct expansion {
+	char **argv;                ///< arguments, null-terminated
+	char **outputs;             ///< captured outputs holding the substituted words
+	int noutputs;               ///< number of captured outputs
+	struct expansion *next;     ///< if non-NULL, expansion of another command
+} expansion_t;
+
+/**
+ * The processes and fan-outs started for one pipeline.
+ */
+typedef struct {
+	pid_t *pids;                ///< processes launched, in order
+	const char **names;         ///< names of the processes launched
+	int npids;                  ///< number of processes launched
+	struct fanout **fanouts;    ///< fan-outs started
+	int nfanouts;               ///< number of fan-outs started
+	struct filter **filters;    ///< built-in filters started, in order
+	int nfilters;               ///< number of built-in filters started
+	int last_filter;            ///< if >= 0, filter launched last, else a process
+	struct placement *placement; ///< if non-NULL, CPUs of the processes
+	int skip;                   ///< number of prefix words of the first command
+	int sink;                   ///< where the output of the pipeline goes
+	expansion_t *expansions;    ///< arguments built by substitutions
+} launch_t;
+
+/**
+ * Non-zero to print pipelines changed by the rewrite pass.
+ */
+static int print_rewrites;
+
+/**
+ * If non-NULL, the helper launching the processes (see zygote.h).
+ */
+static struct zygote *zygote;
+
+static char *read_line(void);
+static int refresh_prompt(void);
+static int run_line(char *line);
+static struct root *parse_line(char *line);
+static struct program *compile_line(const char *source);
+static int run_pipeline(struct command *cmd, void *ctx);
+static int execute(struct command *cmd, int skip, int sink, struct bench *bench);
+static int run_bench(struct command *cmd, int sink);
+static int run_cache(struct command *cmd, int skip, int sink, struct bench *bench);
+static struct cache *open_cache(void);
+static int count_commands(struct command *cmd);
+static char **expand(struct command *cmd, launch_t *l);
+static char *substitute(struct command *cmd, size_t *length);
+static int launch(struct command *cmd, int sourcePipe, launch_t *l);
+static int launch_fanout(struct command *branch, int sourcePipe, launch_t *l);
+static void launch_filter(char **argv, int *sourcePipe, struct ring **sourceRing,
+                          int *infile, int *destPipe, struct ring **destRing,
+                          int *outfile, launch_t *l);
+static int run_builtin(struct command *cmd, int *status);
+static void child_fail(int fd);
+static int exit_status(int wstatus);
+static void print_memstats(void);
 
-int main() {
+int main(int argc, char *argv[]) {
     char *line;
-    while ((line = readline("> ")) != NULL) {
-        struct root *r = parse(line);
-        if (!r->valid) {
-            fprintf(stderr, "Parse error, try again\n");
-            continue;
-        }
-        // My line is syntactically correct.
-        struct command *cmd = r->first_command;
-
-		// sourcePipe
-		int sourcePipe[2];
-		sourcePipe[0] = 0;
-		sourcePipe[1] = 0;
-		// destPipe
-		int destPipe[2];
-		destPipe[0] = 0;
-		destPipe[1] = 0;
+	const char *socket_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "ds:")) != -1) {
+		switch (opt) {
+		case 'd':
+			print_rewrites = 1;
+			break;
+		case 's':
+			socket_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d] [-s socket]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	// The zygote is forked on request while the shell is small.  In
+	// server mode, the workers fork the processes they wait for.
+	if (socket_path == NULL && getenv("SHELL_ZYGOTE") != NULL
+	    && (zygote = zygote_start()) == NULL) { err_with_errno("zygote"); }
+
+	// The allocator statistics are printed at exit on request.
+	if (getenv("SHELL_MEMSTATS") != NULL) { atexit(print_memstats); }
+	// Live metrics are published on request (see metrics.h).
+	const char *stats = getenv("SHELL_STATS");
+	if (stats != NULL && metrics_publish(stats) < 0) { err_with_errno(stats); }
+	// A consumer going away must not kill the shell while it copies
+	// data to it; children get the default action back.
+	signal(SIGPIPE, SIG_IGN);
+
+	// In server mode, the command lines come from clients instead.
+	if (socket_path != NULL) { return serve(socket_path, run_line); }
+
+	// The prompt is configurable (see prompt.h).
+	prompt_init(getenv("SHELL_PROMPT"));
+
+    while ((line = read_line()) != NULL) {
+		if (*line != '\0') { add_history(line); }
+		uint64_t start = metrics_now();
+		int status = 2;
+		// for, while and if blocks are compiled once, possibly over
+		// several lines, then interpreted.
+		if (starts_compound(line)) {
+			char *source = alloc(strlen(line) + 1);
+			strcpy(source, line);
+			struct program *prog = compile_line(source);
+			while (prog->status == COMPILE_INCOMPLETE) {
+				char *more = readline("... ");
+				if (more == NULL) { break; }
+				char *joined = alloc(strlen(source) + strlen(" ; ") + strlen(more) + 1);
+				sprintf(joined, "%s ; %s", source, more);
+				dealloc(source);
+				free(more);
+				source = joined;
+				compile_end(prog);
+				prog = compile_line(source);
+			}
+			if (prog->status == COMPILE_OK) {
+				status = interpret(prog, run_pipeline, NULL);
+			} else {
+				fprintf(stderr, "Parse error, try again\n");
+			}
+			compile_end(prog);
+			dealloc(source);
+		} else {
+			status = run_line(line);
+		}
+		prompt_update(status, metrics_now() - start);
+		free(line);
+    }
+	return 0;
+}
+
+/**
+ * Reads a line at the configured prompt, redrawing it as background
+ * segments become known.
+ *
+ * @return the line, to free with free(), or NULL at end-of-file
+ */
+static char *read_line(void) {
+	char *prompt = prompt_render();
+	// readline calls the hook over and over at the end of a pipe.
+	if (isatty(STDIN_FILENO)) { rl_event_hook = refresh_prompt; }
+	char *line = readline(prompt);
+	rl_event_hook = NULL;
+	dealloc(prompt);
+	return line;
+}
+
+/**
+ * Called by readline while it waits for input.
+ */
+static int refresh_prompt(void) {
+	if (prompt_changed()) {
+		char *prompt = prompt_render();
+		rl_set_prompt(prompt);
+		rl_forced_update_display();
+		dealloc(prompt);
+	}
+	return 0;
+}
+
+/**
+ * Runs a line holding a pipeline or a whole compound command.
+ *
+ * @param line  the line, modified by the parser
+ * @return the exit status, 2 if the line is malformed
+ */
+static int run_line(char *line) {
+	int status = 2;
+	if (starts_compound(line)) {
+		struct program *prog = compile_line(line);
+		if (prog->status == COMPILE_OK) {
+			status = interpret(prog, run_pipeline, NULL);
+		} else {
+			fprintf(stderr, "Parse error, try again\n");
+		}
+		compile_end(prog);
+		return status;
+	}
+
+	struct root *r = parse_line(line);
+	if (r->valid) {
+		// My line is syntactically correct; drop the useless processes.
+		if (rewrite(r) > 0 && print_rewrites) {
+			fputs("rewritten: ", stderr);
+			print_pipeline(stderr, r->first_command);
+		}
+		status = run_pipeline(r->first_command, NULL);
+	} else {
+		fprintf(stderr, "Parse error, try again\n");
+	}
+	parse_end(r);
+	return status;
+}
+
+/**
+ * Parses a line, publishing the parse time and errors.
+ */
+static struct root *parse_line(char *line) {
+	uint64_t start = metrics_now();
+	struct root *r = parse(line);
+	if (r == NULL) { die_with_errno(NULL); }
+	metrics_record(METRIC_PARSE, metrics_now() - start);
+	if (!r->valid) { metrics_count(METRIC_PARSE_ERRORS, 1); }
+	return r;
+}
+
+/**
+ * Compiles a compound command, publishing the compile time and errors.
+ */
+static struct program *compile_line(const char *source) {
+	uint64_t start = metrics_now();
+	struct program *prog = compile(source);
+	metrics_record(METRIC_PARSE, metrics_now() - start);
+	if (prog->status == COMPILE_ERROR) { metrics_count(METRIC_PARSE_ERRORS, 1); }
+	return prog;
+}
+
+/**
+ * Runs a pipeline on the standard output.
+ *
+ * @param cmd  first command of the pipeline
+ * @param ctx  unused
+ * @return the exit status of the last command
+ */
+static int run_pipeline(struct command *cmd, void *ctx) {
+	(void) ctx;
+	return execute(cmd, 0, STDOUT_FILENO, NULL);
+}
+
+/**
+ * Launches every command of a pipeline, then waits for all of them.
+ *
+ * The pipeline is left untouched so that compiled blocks can run it
+ * again.
+ *
+ * @param cmd  first command of the pipeline
+ * @param skip  number of prefix words of the first command already
+ *     handled
+ * @param sink  where the output of the last command goes, if not
+ *     redirected
+ * @param bench  if non-NULL, where to record the wall time of the run
+ *     and the usage of each process
+ * @return the exit status of the last command
+ */
+static int execute(struct command *cmd, int skip, int sink, struct bench *bench) {
+	int status = 0;
+	if (skip == 0 && run_builtin(cmd, &status)) { return status; }
+	if (cmd == NULL) { return 0; }
+
+	// bench [OPTIONS] times repeated runs of the rest of the pipeline.
+	if (skip == 0 && strcmp(cmd->argv[0], "bench") == 0) { return run_bench(cmd, sink); }
+
+	// cache [OPTIONS] replays the output of the rest of the pipeline
+	// when its inputs did not change.
+	if (strcmp(cmd->argv[skip], "cache") == 0) { return run_cache(cmd, skip, sink, bench); }
+
+	// pin MODE runs the rest of the pipeline with its processes bound
+	// to CPUs.
+	struct placement *placement = NULL;
+	if (strcmp(cmd->argv[skip], "pin") == 0) {
+		if (cmd->argv[skip + 1] == NULL || cmd->argv[skip + 2] == NULL
+		    || (placement = placement_new(cmd->argv[skip + 1])) == NULL) {
+			err_with_message("usage: pin compact|spread|cpus=LIST COMMAND ...");
+			return 2;
+		}
+		skip += 2;
+	}
+
+	int ncommands = count_commands(cmd);
+	pid_t pids[ncommands];
+	const char *names[ncommands];
+	struct fanout *fanouts[ncommands];
+	struct filter *filters[ncommands];
+	launch_t l = { pids, names, 0, fanouts, 0, filters, 0, -1, placement, skip, sink, NULL };
+
+	uint64_t start = metrics_now();
+	int ok = launch(cmd, 0, &l);
+
+	// The status of a pipeline is the one of its last command, which
+	// is launched last, even in the last branch of a fan-out.
+	for (int i = 0; i < l.npids; ++i) {
+		int wstatus;
+		struct rusage usage;
+		if (wait4(pids[i], &wstatus, 0, &usage) < 0) { continue; }
+		if (i == l.npids - 1 && l.last_filter < 0) { status = exit_status(wstatus); }
+		if (bench != NULL) { bench_add_stage(bench, i, names[i], &usage); }
+	}
+	for (int i = 0; i < l.nfilters; ++i) {
+		int s = filter_wait(filters[i]);
+		if (i == l.last_filter) { status = s; }
+	}
+	for (int i = 0; i < l.nfanouts; ++i) { fanout_wait(fanouts[i]); }
+	uint64_t wall = metrics_now() - start;
+	metrics_count(METRIC_PIPELINES, 1);
+	metrics_record(METRIC_WALL, wall);
+	if (bench != NULL) { bench_add_run(bench, wall); }
+	placement_free(placement);
+	while (l.expansions != NULL) {
+		expansion_t *e = l.expansions;
+		l.expansions = e->next;
+		for (int i = 0; i < e->noutputs; ++i) { dealloc(e->outputs[i]); }
+		dealloc(e->outputs);
+		dealloc(e->argv);
+		dealloc(e);
+	}
+	return ok ? status : 1;
+}
+
+/**
+ * Runs the bench builtin (see bench.h) on the rest of a pipeline.
+ *
+ * Like with other benchmarking tools, the output of the runs is
+ * discarded; the report goes to sink.
+ */
+static int run_bench(struct command *cmd, int sink) {
+	bench_options_t o;
+	int skip = bench_parse_options(cmd->argv, &o);
+	if (skip == 0) {
+		err_with_message("usage: bench [-n RUNS] [-w WARMUP] [-j] COMMAND ...");
+		return 2;
+	}
+	int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null < 0) {
+		err_with_errno("/dev/null");
+		return 1;
+	}
+
+	struct bench *b = bench_new();
+	int status = 0;
+	for (long i = 0; i < o.warmup + o.runs; ++i) {
+		status = execute(cmd, skip, null, i < o.warmup ? NULL : b);
+	}
+	close(null);
+
+	FILE *out = stdout;
+	if (sink != STDOUT_FILENO) { out = fdopen(fcntl(sink, F_DUPFD_CLOEXEC, 0), "w"); }
+	if (out != NULL) {
+		bench_report(b, out, &o);
+		if (out != stdout) { fclose(out); } else { fflush(out); }
+	}
+	bench_free(b);
+	return status;
+}
+
+/**
+ * Runs the cache builtin (see cache.h) on the rest of a pipeline.
+ *
+ * On a miss, the output of the last command, whether redirected or
+ * going to sink, is teed into the store while the pipeline runs.
+ * Pipelines that cannot be cached run as if the prefix were absent.
+ */
+static int run_cache(struct command *cmd, int skip, int sink, struct bench *bench) {
+	cache_options_t o;
+	int n = cache_parse_options(cmd->argv + skip, &o);
+	if (n == 0) {
+		err_with_message("usage: cache [-c] [-e NAME]... COMMAND ...");
+		return 2;
+	}
+	skip += n;
+	char key[CACHE_KEY_SIZE];
+	struct cache *c;
+	if (cache_key(cmd, skip, &o, key) < 0 || (c = open_cache()) == NULL) {
+		return execute(cmd, skip, sink, bench);
+	}
+
+	struct command *last = cmd;
+	while (last->next != NULL) { last = last->next; }
+	int out = sink;
+	if (last->outfile != NULL) {
+		out = open(last->outfile, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+		if (out < 0) {
+			err_with_errno(last->outfile);
+			cache_close(c);
+			return 1;
+		}
+	}
 
-		// output file descriptor
-		int outfile = 0;
-		int infile = 0;
-
-        while (cmd != NULL) {
-
-			if (cmd->next != NULL){
-				int rc = pipe(destPipe);
-				if (rc < 0) {
-					// pipe failed; exit
-					fprintf(stderr, "destPipe failed\n");
-					exit(1);
-				}
-			} 
-
-			if (cmd->outfile) {
-				outfile = open(cmd->outfile, O_WRONLY | O_CREAT, 0644);
-				if(outfile < 0){
-				  printf("Failed to open outfile.\n");
-				  exit(1);
-				}
+	int status = 0;
+	uint64_t start = metrics_now();
+	if (cache_replay(c, key, out) == 0) {
+		if (bench != NULL) { bench_add_run(bench, metrics_now() - start); }
+	} else {
+		int teePipe[2];
+		if (pipe2(teePipe, O_CLOEXEC) < 0) {
+			err_with_errno("pipe");
+			status = execute(cmd, skip, sink, bench);
+		} else {
+			// The last command writes to the tee instead of its file
+			// for this run only.
+			struct cache_fill *f = cache_fill_start(c, key, teePipe[0], out);
+			char *outfile = last->outfile;
+			last->outfile = NULL;
+			status = execute(cmd, skip, teePipe[1], bench);
+			last->outfile = outfile;
+			close(teePipe[1]);
+			cache_fill_end(f, status == 0);
+		}
+	}
+	if (out != sink) { close(out); }
+	cache_close(c);
+	return status;
+}
+
+/**
+ * Opens the store named by SHELL_CACHE, by default ~/.cache/shell,
+ * with the capacity given by SHELL_CACHE_SIZE.
+ *
+ * @return the store, or NULL after printing an error
+ */
+static struct cache *open_cache(void) {
+	uint64_t capacity = CACHE_CAPACITY;
+	const char *size = getenv("SHELL_CACHE_SIZE");
+	if (size != NULL && !cache_parse_size(size, &capacity)) {
+		err_with_message("SHELL_CACHE_SIZE: invalid size");
+		return NULL;
+	}
+	const char *dir = getenv("SHELL_CACHE");
+	char path[PATH_MAX];
+	if (dir == NULL) {
+		const char *home = getenv("HOME");
+		if (home == NULL) {
+			err_with_message("cache: neither SHELL_CACHE nor HOME is set");
+			return NULL;
+		}
+		snprintf(path, sizeof(path), "%s/.cache/shell", home);
+		dir = path;
+	}
+	struct cache *c = cache_open(dir, capacity);
+	if (c == NULL) { err_with_errno(dir); }
+	return c;
+}
+
+/**
+ * Counts the commands of a pipeline, including those of its branches.
+ */
+static int count_commands(struct command *cmd) {
+	int n = 0;
+	for (; cmd != NULL; cmd = cmd->next) {
+		++n;
+		for (struct command *b = cmd->branches; b != NULL; b = b->next_branch) {
+			n += count_commands(b);
+		}
+	}
+	return n;
+}
+
+/**
+ * Runs the substitutions of a command and builds its arguments.
+ *
+ * The prefix words of the first command, if it is, are dropped.
+ *
+ * @return the null-terminated arguments, or NULL on failure
+ */
+static char **expand(struct command *cmd, launch_t *l) {
+	char **argv = cmd->argv + l->skip;
+	int skip = l->skip;
+	l->skip = 0;
+	if (cmd->substitutions == NULL) { return argv; }
+
+	int nsubstitutions = 0;
+	for (struct substitution *s = cmd->substitutions; s != NULL; s = s->next) { ++nsubstitutions; }
+	expansion_t *e = alloc(sizeof(expansion_t));
+	e->argv = NULL;
+	e->outputs = alloc(nsubstitutions * sizeof(char *));
+	e->noutputs = 0;
+	e->next = l->expansions;
+	l->expansions = e;
+
+	// Run the substitutions in order, counting the words.
+	size_t lengths[nsubstitutions];
+	int nwords = cmd->argc - 1 - skip;
+	for (struct substitution *s = cmd->substitutions; s != NULL; s = s->next) {
+		char *output = substitute(s->first_command, &lengths[e->noutputs]);
+		if (output == NULL) { return NULL; }
+		e->outputs[e->noutputs] = output;
+		if (s->index >= skip) { nwords += split_words(output, lengths[e->noutputs], NULL) - 1; }
+		++e->noutputs;
+	}
+
+	// Splice the words in place of the substitutions.
+	e->argv = alloc((nwords + 1) * sizeof(char *));
+	struct substitution *s = cmd->substitutions;
+	int n = 0;
+	for (int i = 0, k = 0; cmd->argv[i] != NULL; ++i) {
+		if (s != NULL && s->index == i) {
+			if (i >= skip) { n += split_words(e->outputs[k], lengths[k], e->argv + n); }
+			s = s->next;
+			++k;
+		} else if (i >= skip) {
+			e->argv[n++] = cmd->argv[i];
+		}
+	}
+	e->argv[n] = NULL;
+	return e->argv;
+}
+
+/**
+ * Runs a pipeline, capturing its output.
+ *
+ * @param cmd  first command of the pipeline, or NULL
+ * @param length  set to the number of bytes captured
+ * @return the output, as returned by capture_wait()
+ */
+static char *substitute(struct command *cmd, size_t *length) {
+	int captured[2];
+	if (pipe2(captured, O_CLOEXEC) < 0) {
+		err_with_errno("pipe");
+		return NULL;
+	}
+	struct capture *c = capture_start(captured[0], CAPTURE_MAX);
+	execute(cmd, 0, captured[1], NULL);
+	close(captured[1]);
+	return capture_wait(c, length);
+}
+
+/**
+ * Launches the commands of a pipeline without waiting for them.
+ *
+ * All the pipes are created with O_CLOEXEC so that each command only
+ * inherits its own standard input and output.  Built-in filters run
+ * as threads; two adjacent ones are joined by a ring rather than a
+ * pipe.
+ *
+ * @param cmd  first command of the pipeline
+ * @param sourcePipe  read end of a pipe feeding the first command, or
+ *     0 for the standard input; it is closed by this function
+ * @param l  where to record the processes and fan-outs
+ * @return non-zero if every command was launched
+ */
+static int launch(struct command *cmd, int sourcePipe, launch_t *l) {
+	// destPipe
+	int destPipe[2];
+	destPipe[0] = 0;
+	destPipe[1] = 0;
+	// rings between built-in filters
+	struct ring *sourceRing = NULL;
+	struct ring *destRing = NULL;
+
+	// output file descriptor
+	int outfile = 0;
+	int infile = 0;
+
+	while (cmd != NULL) {
+		// Substitutions run as the command comes, the commands before
+		// it already running.
+		char **argv = expand(cmd, l);
+		if (argv == NULL) { break; }
+		if (argv[0] == NULL) {
+			err_with_message("empty command after substitution");
+			break;
+		}
+		int builtin = is_filter(argv);
+
+		// The arguments of a next command with substitutions are not
+		// known yet, so it cannot take a ring.
+		if (builtin && cmd->next != NULL && cmd->next->substitutions == NULL
+		    && is_filter(cmd->next->argv)) {
+			destRing = ring_new(RING_SIZE);
+		} else if (cmd->next != NULL || cmd->branches != NULL){
+			if (pipe2(destPipe, O_CLOEXEC) < 0) {
+				err_with_errno("pipe");
+				break;
+			}
+		}
+
+		if (cmd->outfile) {
+			outfile = open(cmd->outfile, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+			if(outfile < 0){
+				err_with_errno(cmd->outfile);
+				outfile = 0;
+				break;
 			}
-			
-			if (cmd->infile) {
-				infile = open(cmd->infile, O_RDONLY, 0644);
-				if(infile < 0){
-				  printf("Failed to open infile.\n");
-				  exit(1);
-				}
+		}
+
+		if (cmd->infile) {
+			infile = open(cmd->infile, O_RDONLY | O_CLOEXEC, 0644);
+			if(infile < 0){
+				err_with_errno(cmd->infile);
+				infile = 0;
+				break;
 			}
+		}
 
-			int rc = fork();
-			if (rc < 0) {
-				fprintf(stderr, "fork failed\n");
-				exit(1);
-			} else if (rc == 0) {
-				// route data through the proper channel and close loose ends
-				if (sourcePipe[0] != 0) {
-					close(STDIN_FILENO);
-					dup(sourcePipe[0]);
-					close(sourcePipe[0]);
-					close(sourcePipe[1]);
-				}
-				// route data through the proper channel and close loose ends
-				if (destPipe[0] != 0) {
-					close(STDOUT_FILENO);
-					dup(destPipe[1]);
-					close(destPipe[0]);
-					close(destPipe[1]);
-				}
-				if (outfile) {
-					close(STDOUT_FILENO);
-					dup(outfile);
-					close(outfile);
-				}
-				if (infile) {
-				        close(STDIN_FILENO);
-					dup(infile);
-					close(infile);
-				}
-
-				// start the program
-				char *myargs[cmd->argc + 1];
-				for (int i=0 ; i<cmd->argc; ++i) {
-					myargs[i] = cmd->argv[i];
-				}
-				myargs[cmd->argc] = NULL;
-				int rc =  execvp(myargs[0], myargs);
-				if( rc < 0){printf("Command not found.\n");}
-				exit(1);
-			}	
-
-
-			if (sourcePipe[0] != 0) { close(sourcePipe[0]); }
-			if (sourcePipe[1] != 0) { close(sourcePipe[1]); }
-			sourcePipe[0] = destPipe[0];
-			sourcePipe[1] = destPipe[1];
+		if (builtin) {
+			launch_filter(argv, &sourcePipe, &sourceRing, &infile,
+			              &destPipe[1], &destRing, &outfile, l);
+			sourcePipe = destPipe[0];
+			sourceRing = destRing;
 			destPipe[0] = 0;
-			destPipe[1] = 0;
+			destRing = NULL;
+			if (cmd->branches != NULL) {
+				int ok = launch_fanout(cmd->branches, sourcePipe, l);
+				sourcePipe = 0;
+				if (!ok) { return 0; }
+			}
+			cmd = cmd->next;
+			continue;
+		}
 
-			if (outfile != 0) { close(outfile); }
-			if (infile != 0) { close(infile); }
-			outfile = 0;
-			infile = 0;
+		// The child reports a failure to exec through this pipe, which
+		// a successful exec closes.
+		int execPipe[2];
+		if (pipe2(execPipe, O_CLOEXEC) < 0) {
+			err_with_errno("pipe");
+			break;
+		}
 
-            cmd = cmd->next;
-        }
+		uint64_t forked = metrics_now();
+		int rc = -1;
+		if (zygote != NULL) {
+			// The same redirections as in the child below.
+			int fds[3] = {
+				infile ? infile : sourcePipe != 0 ? sourcePipe : STDIN_FILENO,
+				outfile ? outfile : destPipe[1] != 0 ? destPipe[1] : l->sink,
+				STDERR_FILENO,
+			};
+			int cpu = l->placement != NULL ? placement_cpu(l->placement, l->npids) : -1;
+			rc = zygote_spawn(zygote, argv, fds, execPipe[1], cpu);
+			// A stage the helper cannot launch is forked directly; a
+			// helper gone leaves the rest of the session to fork
+			// directly.
+			if (rc < 0 && !zygote_alive(zygote)) {
+				err_with_errno("zygote");
+				zygote_stop(zygote);
+				zygote = NULL;
+			}
+		}
+		if (rc < 0) { rc = fork(); }
+		if (rc < 0) {
+			err_with_errno("fork");
+			close(execPipe[0]);
+			close(execPipe[1]);
+			break;
+		} else if (rc == 0) {
+			// route data through the proper channel; the other
+			// descriptors are closed by exec
+			if (sourcePipe != 0) {
+				if (dup2(sourcePipe, STDIN_FILENO) < 0) { child_fail(execPipe[1]); }
+			}
+			if (destPipe[1] != 0) {
+				if (dup2(destPipe[1], STDOUT_FILENO) < 0) { child_fail(execPipe[1]); }
+			} else if (l->sink != STDOUT_FILENO) {
+				if (dup2(l->sink, STDOUT_FILENO) < 0) { child_fail(execPipe[1]); }
+			}
+			if (outfile) {
+				if (dup2(outfile, STDOUT_FILENO) < 0) { child_fail(execPipe[1]); }
+			}
+			if (infile) {
+				if (dup2(infile, STDIN_FILENO) < 0) { child_fail(execPipe[1]); }
+			}
+			signal(SIGPIPE, SIG_DFL);
+			if (l->placement != NULL) { placement_apply(l->placement, l->npids); }
 
-		if (sourcePipe[0] != 0) { close(sourcePipe[0]); }
-		if (sourcePipe[1] != 0) { close(sourcePipe[1]); }
+			// start the program
+			execvp(argv[0], argv);
+			child_fail(execPipe[1]);
+		}
+		l->names[l->npids] = argv[0];
+		l->pids[l->npids++] = rc;
+		l->last_filter = -1;
 
-		parse_end(r);
-		free(line);
-		while(wait(NULL)>0){;}
-    }
-	return 0;
+		// Wait for the exec, or for the error number explaining its failure.
+		close(execPipe[1]);
+		int err;
+		ssize_t n;
+		while ((n = read(execPipe[0], &err, sizeof(err))) < 0 && errno == EINTR) {;}
+		close(execPipe[0]);
+		metrics_count(METRIC_STAGES, 1);
+		metrics_record(METRIC_FORK_EXEC, metrics_now() - forked);
+		if (n == sizeof(err)) {
+			err_with_errnum(argv[0], err);
+			metrics_count(METRIC_EXEC_FAILURES, 1);
+		}
+
+		if (sourcePipe != 0) { close(sourcePipe); }
+		if (destPipe[1] != 0) { close(destPipe[1]); }
+		sourcePipe = destPipe[0];
+		destPipe[0] = 0;
+		destPipe[1] = 0;
+
+		if (outfile != 0) { close(outfile); }
+		if (infile != 0) { close(infile); }
+		outfile = 0;
+		infile = 0;
+
+		if (cmd->branches != NULL) {
+			int ok = launch_fanout(cmd->branches, sourcePipe, l);
+			sourcePipe = 0;
+			if (!ok) { return 0; }
+		}
+
+		cmd = cmd->next;
+	}
+
+	// On failures, close whatever was opened for the next command; the
+	// commands already launched see the end of their pipes.
+	if (destPipe[0] != 0) { close(destPipe[0]); }
+	if (destPipe[1] != 0) { close(destPipe[1]); }
+	if (outfile != 0) { close(outfile); }
+	if (infile != 0) { close(infile); }
+	if (sourcePipe != 0) { close(sourcePipe); }
+	if (destRing != NULL) { ring_close_writer(destRing); ring_close_reader(destRing); }
+	if (sourceRing != NULL) { ring_close_reader(sourceRing); }
+
+	return cmd == NULL;
 }
 
+/**
+ * Starts a built-in filter on the endpoints prepared by launch().
+ *
+ * The filter takes ownership of all the endpoints, which are reset
+ * here.  Like for processes, the redirections win over the pipes or
+ * rings, which are then closed.
+ */
+static void launch_filter(char **argv, int *sourcePipe, struct ring **sourceRing,
+                          int *infile, int *destPipe, struct ring **destRing,
+                          int *outfile, launch_t *l) {
+	endpoint_t in = { STDIN_FILENO, 0, NULL };
+	endpoint_t out = { STDOUT_FILENO, 0, NULL };
+
+	if (*infile) {
+		in.fd = *infile;
+		in.owned = 1;
+		if (*sourcePipe != 0) { close(*sourcePipe); }
+		if (*sourceRing != NULL) { ring_close_reader(*sourceRing); }
+	} else if (*sourceRing != NULL) {
+		in.ring = *sourceRing;
+	} else if (*sourcePipe != 0) {
+		in.fd = *sourcePipe;
+		in.owned = 1;
+	}
 
+	if (*outfile) {
+		out.fd = *outfile;
+		out.owned = 1;
+		if (*destPipe != 0) { close(*destPipe); }
+		if (*destRing != NULL) { ring_close_writer(*destRing); }
+	} else if (*destRing != NULL) {
+		out.ring = *destRing;
+	} else if (*destPipe != 0) {
+		out.fd = *destPipe;
+		out.owned = 1;
+	} else if (l->sink != STDOUT_FILENO) {
+		// A capture ends once every writer has closed its own copy.
+		out.fd = fcntl(l->sink, F_DUPFD_CLOEXEC, 0);
+		out.owned = out.fd >= 0;
+		if (out.fd < 0) { err_with_errno("fcntl"); }
+	}
 
+	l->last_filter = l->nfilters;
+	l->filters[l->nfilters++] = filter_start(argv, in, out);
+
+	*sourcePipe = 0;
+	*sourceRing = NULL;
+	*infile = 0;
+	*destPipe = 0;
+	*outfile = 0;
+}
+
+/**
+ * Launches the branches of a fan-out and starts copying the output of
+ * the command before them to each of them.
+ *
+ * @param branch  first command of the first branch
+ * @param sourcePipe  read end of the pipe receiving the output to copy;
+ *     it is closed by this function
+ * @param l  where to record the processes and fan-outs
+ * @return non-zero if every command was launched
+ */
+static int launch_fanout(struct command *branch, int sourcePipe, launch_t *l) {
+	int nbranches = 0;
+	for (struct command *b = branch; b != NULL; b = b->next_branch) { ++nbranches; }
+	int outs[nbranches];
+	int ok = 1;
 
+	int n = 0;
+	for (; branch != NULL; branch = branch->next_branch) {
+		int branchPipe[2];
+		if (pipe2(branchPipe, O_CLOEXEC) < 0) {
+			err_with_errno("pipe");
+			ok = 0;
+			break;
+		}
+		outs[n++] = branchPipe[1];
+		ok = launch(branch, branchPipe[0], l) && ok;
+	}
+
+	// Branches that could not be launched are simply not fed.
+	struct fanout *f = fanout_start(sourcePipe, outs, n);
+	if (f != NULL) { l->fanouts[l->nfanouts++] = f; }
+	return ok && f != NULL;
+}
+
+/**
+ * Reports errno to the parent through fd, then exits.
+ *
+ * This function runs in a child between fork() and exec() and thus
+ * only uses async-signal-safe functions.
+ */
+static void child_fail(int fd) {
+	int err = errno;
+	if (write(fd, &err, sizeof(err)) != sizeof(err)) { err_with_errnum(NULL, err); }
+	_exit(127);
+}
+
+/**
+ * Runs a command inside the shell if it is a builtin.
+ *
+ * Builtins are only recognized as the sole command of a pipeline:
+ *
+ *    memstats    prints the allocator statistics
+ *
+ * @param cmd  first command of the pipeline
+ * @param status  set to the exit status of the builtin
+ * @return non-zero if cmd is a builtin
+ */
+static int run_builtin(struct command *cmd, int *status) {
+	if (cmd == NULL || cmd->next != NULL) { return 0; }
+	if (strcmp(cmd->argv[0], "memstats") == 0) {
+		alloc_print_stats(stdout);
+		fflush(stdout);
+		*status = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Prints the allocator statistics on the standard error.
+ */
+static void print_memstats(void) {
+	alloc_print_stats(stderr);
+}
+
+/**
+ * Converts a status filled by waitpid() into a shell exit status.
+ */
+static int exit_status(int wstatus) {
+	if (WIFEXITED(wstatus)) { return WEXITSTATUS(wstatus); }
+	if (WIFSIGNALED(wstatus)) { return 128 + WTERMSIG(wstatus); }
+	return 1;
+}
@@ -0,0 +1,104 @@
+/**
+ * A client for the command server mode of the shell (see server.h).
+ *
+ *    shellc [-t] SOCKET WORD...
+ *
+ * The words are joined with spaces into a command line that the
+ * server runs with the standard streams of this client.  The client
+ * exits with the status of the command line; with -t it also prints
+ * the timings reported by the server on its standard error.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+int main(int argc, char *argv[]) {
+    int timings = 0;
+    int i = 1;
+
+    if (i < argc && strcmp(argv[i], "-t") == 0) {
+        timings = 1;
+        ++i;
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "usage: %s [-t] socket word...\n", argv[0]);
+        exit(2);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[i]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(ENAMETOOLONG));
+        exit(2);
+    }
+    strcpy(addr.sun_path, argv[i]);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(errno));
+        exit(2);
+    }
+
+    char text[SERVER_MAX_REQUEST];
+    size_t length = 0;
+    for (++i; i < argc; ++i) {
+        size_t n = strlen(argv[i]);
+        if (length + n + 1 > sizeof(text)) {
+            fprintf(stderr, "%s: command line too long\n", argv[0]);
+            exit(2);
+        }
+        memcpy(text + length, argv[i], n);
+        length += n;
+        text[length++] = ' ';
+    }
+
+    // Hand our standard streams over with the command line.
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov = { text, length - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, 0) < 0) {
+        fprintf(stderr, "%s: sendmsg: %s\n", argv[0], strerror(errno));
+        exit(2);
+    }
+
+    char reply[128];
+    ssize_t n = recv(sock, reply, sizeof(reply) - 1, 0);
+    int status;
+    long wall, user, sys;
+    if (n <= 0) {
+        fprintf(stderr, "%s: no reply from server\n", argv[0]);
+        exit(2);
+    }
+    reply[n] = '\0';
+    if (sscanf(reply, "status %d wall_us %ld user_us %ld sys_us %ld",
+               &status, &wall, &user, &sys) != 4) {
+        fprintf(stderr, "%s: malformed reply from server\n", argv[0]);
+        exit(2);
+    }
+    if (timings)
+        fprintf(stderr, "wall %ld us, user %ld us, sys %ld us\n", wall, user, sys);
+    exit(status);
+}
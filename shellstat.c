@@ -0,0 +1,89 @@
+/**
+ * A reader of the metrics published by the shell (see metrics.h).
+ *
+ *    shellstat [-i SECONDS] FILE...
+ *
+ * Prints the counters and histograms of each metrics FILE, as
+ * published by shells started with SHELL_STATS=FILE.  With -i, prints
+ * them again every SECONDS until interrupted.  The shells are neither
+ * stopped nor signalled.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+static const char *counter_names[METRIC_COUNTERS] = {
+    "pipelines", "stages forked", "exec failures", "parse errors",
+};
+
+static const char *histogram_names[METRIC_HISTOGRAMS] = {
+    "parse", "fork-to-exec", "pipeline wall",
+};
+
+/**
+ * Prints one snapshot of metrics.
+ */
+static void print_metrics(const char *path, const metrics_t *m) {
+    printf("%s (pid %llu)\n", path, (unsigned long long) m->pid);
+    for (int i = 0; i < METRIC_COUNTERS; ++i) {
+        printf("  %-15s %llu\n", counter_names[i], (unsigned long long) m->counters[i]);
+    }
+    for (int i = 0; i < METRIC_HISTOGRAMS; ++i) {
+        const histogram_t *h = &m->histograms[i];
+        printf("  %-15s count %llu, mean %llu us, p50 <%llu us, p90 <%llu us, p99 <%llu us\n",
+               histogram_names[i], (unsigned long long) h->count,
+               (unsigned long long) (h->count > 0 ? h->sum / h->count : 0),
+               (unsigned long long) metrics_percentile(h, 50),
+               (unsigned long long) metrics_percentile(h, 90),
+               (unsigned long long) metrics_percentile(h, 99));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int interval = 0;
+    int i = 1;
+    if (i + 1 < argc && strcmp(argv[i], "-i") == 0) {
+        interval = atoi(argv[i + 1]);
+        i += 2;
+    }
+    if (i == argc || interval < 0) {
+        fprintf(stderr, "usage: %s [-i seconds] file...\n", argv[0]);
+        exit(2);
+    }
+
+    int nfiles = argc - i;
+    const metrics_t *mapped[nfiles];
+    int status = 0;
+    for (int f = 0; f < nfiles; ++f) {
+        mapped[f] = metrics_map(argv[i + f]);
+        if (mapped[f] == NULL) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i + f],
+                    errno == EINVAL ? "not a metrics file" : strerror(errno));
+            status = 1;
+        }
+    }
+
+    for (;;) {
+        for (int f = 0; f < nfiles; ++f) {
+            metrics_t copy;
+            if (mapped[f] == NULL) continue;
+            if (metrics_snapshot(mapped[f], &copy) < 0) {
+                fprintf(stderr, "%s: %s: busy\n", argv[0], argv[i + f]);
+                status = 1;
+                continue;
+            }
+            print_metrics(argv[i + f], &copy);
+        }
+        if (interval == 0) break;
+        fflush(stdout);
+        sleep(interval);
+    }
+    exit(status);
+}
@@ -0,0 +1,17 @@
+/**
+ * Support for the background threads of the shell.
+ */
+
+#include "thread.h"
+
+#include <signal.h>
+
+int start_thread(pthread_t *thread, void *(*body)(void *), void *arg) {
+    // The new thread inherits the mask of its creator.
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int rc = pthread_create(thread, NULL, body, arg);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return rc;
+}
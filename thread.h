@@ -0,0 +1,18 @@
+#pragma once
+
+#include <pthread.h>
+
+/**
+ * Support for the background threads of the shell.
+ */
+
+/**
+ * Creates a thread with every signal blocked, so that it never takes
+ * the signals meant for the shell, such as SIGINT or SIGCHLD.
+ *
+ * @param thread  filled with the ID of the thread
+ * @param body  function the thread runs
+ * @param arg  argument of body
+ * @return 0, or an error number as returned by pthread_create()
+ */
+int start_thread(pthread_t *thread, void *(*body)(void *), void *arg);
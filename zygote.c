@@ -0,0 +1,304 @@
+/**
+ * Support for launching processes through a zygote.
+ *
+ * A request is one SOCK_SEQPACKET message: a header followed by the
+ * current directory, the arguments and the environment, each string
+ * null-terminated, with the three standard descriptors and the report
+ * descriptor attached.  The reply is the process ID, or a negated
+ * error number.
+ */
+
+#define _GNU_SOURCE
+
+#include "zygote.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc.h"
+
+/**
+ * The size of the largest request.
+ */
+#define ZYGOTE_MAX_REQUEST 65536
+
+/**
+ * The number of descriptors attached to a request.
+ */
+#define NFDS 4
+
+extern char **environ;
+
+/**
+ * The header of a request.
+ */
+typedef struct {
+    int32_t cpu;            ///< CPU to bind the process to, or -1
+    int32_t argc;           ///< number of arguments
+    int32_t envc;           ///< number of environment variables
+} header_t;
+
+/**
+ * This structure represents the helper, seen from the shell.
+ */
+typedef struct zygote {
+    pid_t pid;              ///< process ID of the helper
+    int sock;               ///< socket to the helper, or -1 once gone
+    char *buffer;           ///< ZYGOTE_MAX_REQUEST bytes for requests
+} zygote_t;
+
+static void serve(int sock);
+static ssize_t receive(int sock, char *buffer, int fds[NFDS]);
+static pid_t spawn(char *buffer, size_t length, const int fds[NFDS]);
+static char **split(char **s, char *end, int n);
+static void fail(int report);
+
+
+zygote_t *zygote_start(void) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) return NULL;
+    pid_t pid = fork();
+    if (pid < 0) {
+        int err = errno;
+        close(sv[0]);
+        close(sv[1]);
+        errno = err;
+        return NULL;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        serve(sv[1]);
+    }
+    close(sv[1]);
+
+    zygote_t *z = alloc(sizeof(zygote_t));
+    z->pid = pid;
+    z->sock = sv[0];
+    z->buffer = alloc(ZYGOTE_MAX_REQUEST);
+    return z;
+}
+
+pid_t zygote_spawn(zygote_t *z, char **argv, const int fds[3], int report, int cpu) {
+    if (z->sock < 0) {
+        errno = EPIPE;
+        return -1;
+    }
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return -1;
+
+    // Lay out the header, then the strings.
+    header_t h = { cpu, 0, 0 };
+    size_t length = sizeof(h);
+    char *strings[] = { cwd, NULL };
+    char **lists[] = { strings, argv, environ };
+    for (int l = 0; l < 3; ++l) {
+        for (char **s = lists[l]; *s != NULL; ++s) {
+            size_t n = strlen(*s) + 1;
+            if (n > ZYGOTE_MAX_REQUEST - length) {
+                errno = E2BIG;
+                return -1;
+            }
+            memcpy(z->buffer + length, *s, n);
+            length += n;
+            if (l == 1) ++h.argc;
+            if (l == 2) ++h.envc;
+        }
+    }
+    memcpy(z->buffer, &h, sizeof(h));
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(NFDS * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { z->buffer, length };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(NFDS * sizeof(int));
+    int all[NFDS] = { fds[0], fds[1], fds[2], report };
+    memcpy(CMSG_DATA(c), all, sizeof(all));
+
+    ssize_t n;
+    while ((n = sendmsg(z->sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (n < 0 && errno == EMSGSIZE) {
+        errno = E2BIG;
+        return -1;
+    }
+    int32_t reply = 0;
+    if (n >= 0) {
+        while ((n = recv(z->sock, &reply, sizeof(reply), 0)) < 0 && errno == EINTR)
+            ;
+    }
+    if (n != sizeof(reply)) {
+        // The helper is gone; nothing was launched.
+        if (n >= 0) errno = EPIPE;
+        int err = errno;
+        close(z->sock);
+        z->sock = -1;
+        errno = err;
+        return -1;
+    }
+    if (reply < 0) {
+        errno = -reply;
+        return -1;
+    }
+    return reply;
+}
+
+int zygote_alive(zygote_t *z) {
+    return z->sock >= 0;
+}
+
+void zygote_stop(zygote_t *z) {
+    // The helper exits at the end of the requests.
+    if (z->sock >= 0) close(z->sock);
+    while (waitpid(z->pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+    dealloc(z->buffer);
+    dealloc(z);
+}
+
+
+/**
+ * The body of the helper: serves requests until the shell goes away.
+ */
+static void serve(int sock) {
+    prctl(PR_SET_NAME, "shell-zygote");
+    char *buffer = alloc(ZYGOTE_MAX_REQUEST);
+    for (;;) {
+        int fds[NFDS];
+        ssize_t n = receive(sock, buffer, fds);
+        if (n == 0) _exit(0);
+
+        int32_t reply = -EPROTO;
+        if (n > 0) {
+            pid_t pid = spawn(buffer, n, fds);
+            reply = pid > 0 ? pid : -errno;
+            for (int i = 0; i < NFDS; ++i) close(fds[i]);
+        }
+        if (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0) _exit(0);
+    }
+}
+
+/**
+ * Receives a request.
+ *
+ * @return the length of a well-formed request, with its descriptors
+ *     in fds; -1 for a malformed one; 0 at the end
+ */
+static ssize_t receive(int sock, char *buffer, int fds[NFDS]) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(NFDS * sizeof(int))];
+    } control;
+    struct iovec iov = { buffer, ZYGOTE_MAX_REQUEST };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0) return 0;
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c == NULL || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS
+        || c->cmsg_len != CMSG_LEN(NFDS * sizeof(int)))
+        return -1;
+    memcpy(fds, CMSG_DATA(c), NFDS * sizeof(int));
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC) || (size_t) n < sizeof(header_t)) {
+        for (int i = 0; i < NFDS; ++i) close(fds[i]);
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * Creates the process of a request as a child of the shell.
+ *
+ * @return the process ID, or -1 with errno set
+ */
+static pid_t spawn(char *buffer, size_t length, const int fds[NFDS]) {
+    header_t h;
+    memcpy(&h, buffer, sizeof(h));
+    char *end = buffer + length;
+    char *cwd = buffer + sizeof(h);
+    char **argv = NULL, **env = NULL;
+    pid_t pid = -1;
+    errno = EPROTO;
+    if (h.argc > 0 && h.envc >= 0 && end > cwd && end[-1] == '\0') {
+        char *s = cwd + strlen(cwd) + 1;
+        argv = split(&s, end, h.argc);
+        env = argv != NULL ? split(&s, end, h.envc) : NULL;
+        // The process becomes a sibling of the helper.
+        if (env != NULL && s == end) pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < 3; ++i) {
+            if (dup2(fds[i], i) < 0) fail(fds[3]);
+        }
+        if (chdir(cwd) < 0) fail(fds[3]);
+        signal(SIGPIPE, SIG_DFL);
+        if (h.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(h.cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        execvpe(argv[0], argv, env);
+        fail(fds[3]);
+    }
+    int err = errno;
+    dealloc(argv);
+    dealloc(env);
+    errno = err;
+    return pid;
+}
+
+/**
+ * Collects n strings laid out from *s, moving *s past them.
+ *
+ * @return the null-terminated strings, or NULL if fewer remain
+ */
+static char **split(char **s, char *end, int n) {
+    char **strings = alloc((n + 1) * sizeof(char *));
+    for (int i = 0; i < n; ++i) {
+        if (*s >= end) {
+            dealloc(strings);
+            return NULL;
+        }
+        strings[i] = *s;
+        *s += strlen(*s) + 1;
+    }
+    strings[n] = NULL;
+    return strings;
+}
+
+/**
+ * Reports a failure to exec, like the children of the shell.
+ */
+static void fail(int report) {
+    int err = errno;
+    if (write(report, &err, sizeof(err)) != sizeof(err)) {;}
+    _exit(127);
+}
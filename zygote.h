@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/types.h>
+
+/**
+ * Support for launching processes through a zygote: a small helper
+ * process forked early, while the shell is still small, which forks
+ * and execs on the shell's behalf.  The cost of fork() grows with the
+ * address space of the caller, so launches from the helper stay as
+ * fast as at startup however large the shell grows.
+ *
+ * The shell sends the arguments, current directory and environment of
+ * each process with its standard input, output and error over a
+ * socket, the descriptors as SCM_RIGHTS.  The helper creates the
+ * process with clone(CLONE_PARENT), so that it is a child of the shell
+ * rather than of the helper: the shell waits for it and gets its
+ * usage as usual.
+ */
+
+struct zygote; // forward declaration
+
+/**
+ * Forks the helper.
+ *
+ * This must be called before starting any thread.
+ *
+ * @return a handle for zygote_spawn(), or NULL with errno set
+ */
+struct zygote *zygote_start(void);
+
+/**
+ * Launches a process through the helper.
+ *
+ * The process runs argv[0], searched in PATH, in the current directory
+ * and environment of the caller.  On a failure to exec, it writes the
+ * error number to report, which it otherwise closes by the exec, like
+ * the children of the shell.
+ *
+ * The caller keeps its descriptors.  Once the helper is found gone,
+ * every later call fails with EPIPE.
+ *
+ * @param z  handle returned by zygote_start()
+ * @param argv  null-terminated arguments
+ * @param fds  standard input, output and error of the process
+ * @param report  where the process writes an exec failure
+ * @param cpu  CPU to bind the process to, or -1
+ * @return the process ID, or -1 with errno set, in which case the
+ *     caller should fork instead; E2BIG if the request is too large to
+ *     send
+ */
+pid_t zygote_spawn(struct zygote *z, char **argv, const int fds[3], int report, int cpu);
+
+/**
+ * Tells whether the helper is still there.
+ *
+ * @param z  handle returned by zygote_start()
+ * @return zero once a call to zygote_spawn() found the helper gone
+ */
+int zygote_alive(struct zygote *z);
+
+/**
+ * Ends the helper, waits for it and frees the handle.
+ *
+ * @param z  handle returned by zygote_start()
+ */
+void zygote_stop(struct zygote *z);